@@ -0,0 +1,127 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rbcc.h"
+
+_Thread_local alloc_counters alloc_stats = {0};
+
+// The external definition, for the calls the compiler does not inline
+extern inline void *NONNULL xmalloc(size_t size);
+extern inline void *NONNULL xrealloc(void *NULLABLE ptr, size_t size);
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN      (_Alignof(max_align_t))
+
+struct arena_block {
+    arena_block *NULLABLE next;
+    size_t                used;
+    size_t                cap;
+};
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static u8 *NONNULL block_data(arena_block *NONNULL block) {
+    return (u8 *)block + align_up(sizeof(arena_block));
+}
+
+static arena_block *NONNULL block_new(size_t cap) {
+    arena_block *block = xmalloc(align_up(sizeof(arena_block)) + cap);
+    *block             = (arena_block){.next = NULL, .used = 0, .cap = cap};
+    return block;
+}
+
+void *NONNULL arena_alloc(arena *NONNULL a, size_t size) {
+    size = align_up(size);
+    if (a->blocks == NULL || a->blocks->used + size > a->blocks->cap) {
+        if (size > ARENA_BLOCK_SIZE / 4 && a->blocks != NULL) {
+            // Big allocations get their own block, behind the current one,
+            // so the rest of the current block can still be used.
+            arena_block *block = block_new(size);
+            block->used        = size;
+            block->next        = a->blocks->next;
+            a->blocks->next    = block;
+            return block_data(block);
+        }
+        arena_block *block =
+            block_new(size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+        block->next = a->blocks;
+        a->blocks   = block;
+    }
+
+    void *ptr = block_data(a->blocks) + a->blocks->used;
+    a->blocks->used += size;
+    return ptr;
+}
+
+void *NONNULL arena_realloc(arena *NONNULL a, void *NULLABLE ptr,
+                            size_t old_size, size_t new_size) {
+    if (ptr == NULL) {
+        return arena_alloc(a, new_size);
+    }
+    if (new_size <= old_size) {
+        return ptr;
+    }
+
+    arena_block *block = a->blocks;
+    u8          *end   = block_data(block) + block->used;
+    if ((u8 *)ptr + align_up(old_size) == end &&
+        block->used - align_up(old_size) + align_up(new_size) <= block->cap) {
+        block->used += align_up(new_size) - align_up(old_size);
+        return ptr;
+    }
+
+    void *new_ptr = arena_alloc(a, new_size);
+    memcpy(new_ptr, ptr, old_size);
+    return new_ptr;
+}
+
+str arena_str_clone(arena *NONNULL a, str s) {
+    u8 *buffer = arena_alloc(a, s.len + 1);
+    if (s.len > 0) {
+        memcpy(buffer, s.data, s.len);
+    }
+    buffer[s.len] = 0; // '\0' byte
+    return (str){.data = buffer, .len = s.len};
+}
+
+str arena_slice_clone(arena *NONNULL a, str_slice slice) {
+    return arena_str_clone(a, (str){.data = slice.data, .len = slice.len});
+}
+
+str PRINTF_FORMAT(2, 3)
+    arena_print_str(arena *NONNULL a, char const *NONNULL fmt, ...) {
+    va_list arg1, arg2;
+    va_start(arg1, fmt);
+    va_copy(arg2, arg1);
+    int buffer_size = vsnprintf(NULL, 0, fmt, arg1) + 1;
+    va_end(arg1);
+    char *buffer = arena_alloc(a, buffer_size);
+    vsnprintf(buffer, buffer_size, fmt, arg2);
+    va_end(arg2);
+    return (str){.data = (u8 *)buffer, .len = buffer_size - 1};
+}
+
+void arena_free(arena *NONNULL a) {
+    arena_block *block = a->blocks;
+    while (block != NULL) {
+        arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    a->blocks = NULL;
+}
+
+void arena_reset(arena *NONNULL a) {
+    if (a->blocks == NULL) {
+        return;
+    }
+    arena_block *kept = a->blocks;
+    a->blocks         = kept->next;
+    arena_free(a);
+    kept->used = 0;
+    a->blocks  = kept;
+}
@@ -3,123 +3,61 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "da.h"
 #include "lexer.h"
 #include "rbcc.h"
 
 void program_print(program *NONNULL prog) {
     printf("program(");
     if (prog->main_function) {
-        stmt_print(prog->main_function);
+        stmt_print(prog, prog->main_function);
     } else {
         printf("null");
     }
     printf(")");
 }
 
-program *program_new(program prog) {
-    program *ptr = xmalloc(sizeof(program));
+program *program_new(arena *NONNULL a, program prog) {
+    program *ptr = arena_alloc(a, sizeof(program));
     *ptr         = prog;
     return ptr;
 }
 
-void program_free(program *NULLABLE prog) {
-    if (!prog) {
-        return;
-    }
-    stmt_free(prog->main_function);
-    free(prog);
+void program_free(program *NONNULL prog) {
+    free(prog->exprs.tags);
+    free(prog->exprs.ops);
+    free(prog->exprs.tokens);
+    free(prog->exprs.lhs);
+    free(prog->exprs.rhs);
+    da_free(&prog->expr_lists);
+    da_free(&prog->tokens);
+    da_free(&prog->constants);
+    prog->exprs      = (exprs){0};
+    prog->expr_lists = (expr_ids){0};
+    prog->tokens     = (tokens){0};
+    prog->constants  = (constants){0};
 }
 
-void stmt_print(stmt *NONNULL ptr) {
+void stmt_print(program const *NONNULL prog, stmt *NONNULL ptr) {
     stmt s = *ptr;
     switch (s.tag) {
         case stmt_function: {
             struct stmt_function data = s.data.stmt_function;
-            printf("stmt_function(name = %s, body = ", data.name.data);
-            expr_print(data.body);
+            printf("stmt_function(name = %s, body = ",
+                   interned_str(prog->names, data.name).data);
+            expr_print(prog, data.body);
             printf(")");
             return;
         }
     }
 }
 
-stmt *NONNULL stmt_new(stmt s) {
-    stmt *ptr = xmalloc(sizeof(stmt));
+stmt *NONNULL stmt_new(arena *NONNULL a, stmt s) {
+    stmt *ptr = arena_alloc(a, sizeof(stmt));
     *ptr      = s;
     return ptr;
 }
 
-void stmt_free(stmt *ptr) {
-    if (!ptr) {
-        return;
-    }
-
-    stmt s = *ptr;
-    switch (s.tag) {
-        case stmt_function: {
-            struct stmt_function data = s.data.stmt_function;
-            expr_free(data.body);
-            str_free(data.name);
-            free(ptr);
-            return;
-        }
-    }
-}
-
-expr_list_buffer expr_list_buffer_new(size_t initial_cap) {
-    if (initial_cap <= 0) {
-        initial_cap = 2;
-    }
-    return (expr_list_buffer){
-        .len  = 0,
-        .cap  = initial_cap,
-        .data = xmalloc(sizeof(expr *) * initial_cap),
-    };
-}
-
-void expr_list_buffer_push(expr_list_buffer *NONNULL buffer, expr *NULLABLE e) {
-    if (buffer->cap <= buffer->len) {
-        buffer->cap *= 2;
-        buffer->data = realloc(buffer->data, sizeof(expr *) * buffer->cap);
-    }
-    buffer->data[buffer->len] = e;
-    buffer->len += 1;
-}
-
-void expr_list_buffer_free(expr_list_buffer buffer) { free(buffer.data); }
-
-void expr_list_buffer_free_all(expr_list_buffer buffer) {
-    for (size_t i = 0; i < buffer.len; i++) {
-        expr_free(buffer.data[i]);
-    }
-    expr_list_buffer_free(buffer);
-}
-
-void expr_list_print(expr_list *NONNULL list) {
-    for (size_t i = 0; i < list->len; i++) {
-        expr_print(list->data[i]);
-        if (i + 1 < list->len) {
-            printf(", ");
-        }
-    }
-}
-
-expr_list expr_list_new(expr_list_buffer const buffer) {
-    assert(0 < buffer.len);
-    expr_list list = {0};
-    list.data      = xmalloc(sizeof(expr) * buffer.len);
-    memcpy(list.data, buffer.data, sizeof(expr) * buffer.len);
-    list.len = buffer.len;
-    return list;
-}
-
-void expr_list_free(expr_list list) {
-    for (size_t i = 0; i < list.len; i++) {
-        expr_free(list.data[i]);
-    }
-    free(list.data);
-}
-
 char const *const binary_operator_strs[] = {
 #define _X(op, symbol) [op] = #symbol,
     BINARY_OPERATORS
@@ -133,76 +71,127 @@ char const *binary_operator_str(binary_operator op) {
     return binary_operator_strs[op];
 }
 
-void expr_print(expr *NONNULL ptr) {
-    expr e = *ptr;
-    switch (e.tag) {
-        case expr_string: {
-            struct expr_string data = e.data.expr_string;
-            printf("expr_string(\"%s\")", data.content.data);
-            return;
+// The pieces of a expression that are still to be printed, the expressions are
+// expanded with a explicit stack, so deep expressions can be printed
+typedef struct print_work {
+    enum {
+        print_expr,
+        print_text,
+        print_operator, // the operator of the binary expression
+    } kind;
+    expr_id              e;
+    char const *NULLABLE text;
+} print_work;
+
+typedef struct print_stack {
+    print_work *NULLABLE items;
+    size_t               count;
+    size_t               capacity;
+} print_stack;
+
+#define PUSH_EXPR(e) da_append(&stack, ((print_work){print_expr, (e), NULL}))
+#define PUSH_TEXT(text) \
+    da_append(&stack, ((print_work){print_text, 0, (text)}))
+#define PUSH_OPERATOR(e) \
+    da_append(&stack, ((print_work){print_operator, (e), NULL}))
+
+void expr_print(program const *NONNULL prog, expr_id root) {
+    exprs const *x     = &prog->exprs;
+    print_stack  stack = {0};
+    PUSH_EXPR(root);
+    while (stack.count > 0) {
+        print_work w = stack.items[--stack.count];
+        if (w.kind == print_text) {
+            printf("%s", w.text);
+            continue;
         }
-        case expr_function_call: {
-            struct expr_function_call data = e.data.expr_function_call;
-            printf("expr_function_call(");
-            expr_list_print(&data.params);
-            printf(")");
-            return;
+        if (w.kind == print_operator) {
+            printf(" %s ", binary_operator_str(x->ops[w.e]));
+            continue;
         }
-        case expr_constant: {
-            struct expr_constant data = e.data.expr_constant;
-            printf("expr_constant(%ld)", data.value);
-            return;
-        }
-        case expr_binary: {
-            struct expr_binary data = e.data.expr_binary;
-            printf("expr_binary(");
-            expr_print(data.lhs);
-            printf(" %s ", binary_operator_str(data.op));
-            expr_print(data.rhs);
-            printf(")");
-            return;
+
+        expr_id e = w.e;
+        switch ((expr_tag)x->tags[e]) {
+            case expr_string: {
+                token tok = prog->tokens.items[x->tokens[e]];
+                printf("expr_string(%.*s)", (int)tok.len,
+                       prog->source.data + tok.pos);
+                break;
+            }
+            case expr_function_call: {
+                // Pushed in reverse, the first parameter is printed first
+                printf("expr_function_call(");
+                PUSH_TEXT(")");
+                for (u32 i = x->rhs[e]; i > 0; i--) {
+                    PUSH_EXPR(prog->expr_lists.items[x->lhs[e] + i - 1]);
+                    if (i > 1) {
+                        PUSH_TEXT(", ");
+                    }
+                }
+                break;
+            }
+            case expr_constant: {
+                printf("expr_constant(%ld)", prog->constants.items[x->lhs[e]]);
+                break;
+            }
+            case expr_binary: {
+                printf("expr_binary(");
+                PUSH_TEXT(")");
+                PUSH_EXPR(x->rhs[e]);
+                PUSH_OPERATOR(e);
+                PUSH_EXPR(x->lhs[e]);
+                break;
+            }
         }
     }
+    da_free(&stack);
 }
 
-expr *NONNULL expr_new(expr e) {
-    expr *ptr = xmalloc(sizeof(expr));
-    *ptr      = e;
-    return ptr;
-}
+#undef PUSH_EXPR
+#undef PUSH_TEXT
+#undef PUSH_OPERATOR
 
-void expr_free(expr *NULLABLE ptr) {
-    if (!ptr) {
-        return;
-    }
+u32 expr_pos(program const *NONNULL prog, expr_id e) {
+    return prog->tokens.items[prog->exprs.tokens[e]].pos;
+}
 
-    expr e = *ptr;
+// The arrays share the count and the capacity, so they grow together
+static void exprs_grow(exprs *NONNULL x) {
+    x->capacity = x->capacity == 0 ? 64 : x->capacity * 2;
+    x->tags     = xrealloc(x->tags, x->capacity * sizeof(*x->tags));
+    x->ops      = xrealloc(x->ops, x->capacity * sizeof(*x->ops));
+    x->tokens   = xrealloc(x->tokens, x->capacity * sizeof(*x->tokens));
+    x->lhs      = xrealloc(x->lhs, x->capacity * sizeof(*x->lhs));
+    x->rhs      = xrealloc(x->rhs, x->capacity * sizeof(*x->rhs));
+}
 
-    lexer_token_free(e.root_token);
-    switch (e.tag) {
-        case expr_string: {
-            struct expr_string data = e.data.expr_string;
-            str_free(data.content);
-            free(ptr);
-            return;
-        }
-        case expr_function_call: {
-            struct expr_function_call data = e.data.expr_function_call;
-            expr_list_free(data.params);
-            free(ptr);
-            return;
-        }
-        case expr_constant: {
-            /*struct expr_constant data = e.data.expr_constant;*/
-            free(ptr);
-            return;
-        }
-        case expr_binary: {
-            struct expr_binary data = e.data.expr_binary;
-            expr_free(data.lhs);
-            expr_free(data.rhs);
-            free(ptr);
-            return;
-        }
+expr_id expr_new(program *NONNULL prog, expr_tag tag, u32 token, u32 lhs,
+                 u32 rhs) {
+    exprs *x = &prog->exprs;
+    if (x->count == x->capacity) {
+        exprs_grow(x);
+    }
+    expr_id e    = (expr_id)x->count++;
+    x->tags[e]   = (u8)tag;
+    x->ops[e]    = 0;
+    x->tokens[e] = token;
+    x->lhs[e]    = lhs;
+    x->rhs[e]    = rhs;
+    return e;
+}
+
+expr_id expr_binary_new(program *NONNULL prog, u32 token, binary_operator op,
+                        expr_id lhs, expr_id rhs) {
+    expr_id e          = expr_new(prog, expr_binary, token, lhs, rhs);
+    prog->exprs.ops[e] = (u8)op;
+    return e;
+}
+
+expr_id expr_function_call_new(program *NONNULL prog, u32 token,
+                               expr_id const *NONNULL params, u32 count) {
+    u32 first = (u32)prog->expr_lists.count;
+    for (u32 i = 0; i < count; i++) {
+        da_append(&prog->expr_lists, params[i]);
     }
+    return expr_new(prog, expr_function_call, token, first, count);
 }
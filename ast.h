@@ -1,48 +1,76 @@
 #pragma once
 
 #include <stddef.h>
+#include "intern.h"
 #include "lexer.h"
 #include "rbcc.h"
 // AST
+// The statements are allocated in a arena, they are released together with
+// it. The expressions live in parallel arrays owned by the program.
 typedef struct program program;
 
 // Statements
 typedef struct stmt stmt;
 
 // Expressions
-typedef struct expr expr;
-
-typedef struct expr_list_buffer {
-    expr *NONNULL *NULLABLE data;
-    size_t                  len;
-    size_t                  cap;
-} expr_list_buffer;
-
-expr_list_buffer expr_list_buffer_new(size_t initial_cap);
-void             expr_list_buffer_push(expr_list_buffer *NONNULL buffer,
-                                       expr *NULLABLE            expr);
-// Frees the buffer itself, not the expr it contains
-void expr_list_buffer_free(expr_list_buffer buffer);
-// Frees the buffer and all the expr it contains
-void expr_list_buffer_free_all(expr_list_buffer buffer);
-
-typedef struct expr_list {
-    expr *NONNULL *NULLABLE data;
-    size_t                  len;
-} expr_list;
-
-void expr_list_print(expr_list *NONNULL list);
-// Makes a copy of the buffer, does _NOT_ free the buffer.
-expr_list expr_list_new(expr_list_buffer const buffer);
-void      expr_list_free(expr_list list);
+// A expression is the index into the arrays of program.exprs. The operands of
+// a expression are always added before it, so every expression tree is stored
+// in post order and ends with its root.
+typedef u32 expr_id;
+
+// Stands in for the expressions the parser could not parse
+#define EXPR_NONE ((expr_id)UINT32_MAX)
+
+typedef enum expr_tag {
+    expr_constant,
+    expr_binary,
+    expr_string,
+    expr_function_call,
+} expr_tag;
+
+typedef struct exprs {
+    u8 *NULLABLE  tags;   // the expr_tag
+    u8 *NULLABLE  ops;    // expr_binary: the binary_operator
+    u32 *NULLABLE tokens; // the index of the root token in program.tokens
+    // expr_constant: lhs is the index into program.constants
+    // expr_binary: lhs and rhs are the operands
+    // expr_string: unused, the content is the literal of the token
+    // expr_function_call: the parameters are the rhs expr_ids starting at lhs
+    // in program.expr_lists
+    u32 *NULLABLE lhs;
+    u32 *NULLABLE rhs;
+    size_t        count;
+    size_t        capacity;
+} exprs;
+
+typedef struct expr_ids {
+    expr_id *NULLABLE items;
+    size_t            count;
+    size_t            capacity;
+} expr_ids;
 
 struct program {
     struct stmt *NULLABLE main_function;
+    exprs                 exprs;
+    // The parameter lists of the function calls
+    expr_ids              expr_lists;
+    // The program takes the tokens and the values of the constants over from
+    // the parser and the lexer, the expressions refer to them
+    tokens                tokens;
+    constants             constants;
+    // The input the tokens point into
+    str                   source;
+    // The names used in the program are interned here
+    interner *NONNULL     names;
+    // The lines of the source, for the locations of diagnostics
+    line_table *NONNULL   lines;
 };
 
 void             program_print(program *NONNULL prog);
-program *NONNULL program_new(program prog);
-void             program_free(program *NULLABLE prog);
+program *NONNULL program_new(arena *NONNULL a, program prog);
+// Frees the expressions, tokens and constants, the program itself and the
+// statements live in the arena
+void             program_free(program *NONNULL prog);
 
 struct stmt {
     enum {
@@ -50,18 +78,17 @@ struct stmt {
     } tag;
     union {
         struct stmt_function {
-            str            name;
-            expr *NULLABLE body;
+            name_id name;
+            expr_id body;
         } stmt_function;
     } data;
 };
 
-void          stmt_print(stmt *NONNULL stmt);
-stmt *NONNULL stmt_new(stmt stmt);
-void          stmt_free(stmt *NULLABLE stmt);
+void stmt_print(program const *NONNULL prog, stmt *NONNULL stmt);
+stmt *NONNULL stmt_new(arena *NONNULL a, stmt stmt);
 
-#define STMT_NEW(tag, ...) \
-    stmt_new((stmt){tag, {.tag = (struct tag){__VA_ARGS__}}})
+#define STMT_NEW(a, tag, ...) \
+    stmt_new((a), (stmt){tag, {.tag = (struct tag){__VA_ARGS__}}})
 
 #define BINARY_OPERATORS \
     _X(BOP_ADD, +)       \
@@ -79,36 +106,13 @@ typedef enum binary_operator {
 extern char const *NONNULL const binary_operator_strs[];
 char const              *NONNULL binary_operator_str(binary_operator op);
 
-struct expr {
-    enum {
-        expr_constant,
-        expr_binary,
-        expr_string,
-        expr_function_call,
-    } tag;
-    token root_token;
-    union {
-        struct expr_constant {
-            i64 value;
-        } expr_constant;
-        struct expr_binary {
-            binary_operator op;
-            expr *NONNULL   lhs;
-            expr *NONNULL   rhs;
-        } expr_binary;
-        struct expr_string {
-            str content; // this is owned
-        } expr_string;
-        struct expr_function_call {
-            expr_list params;
-        } expr_function_call;
-    } data;
-};
-
-void          expr_print(expr *NONNULL expr);
-expr *NONNULL expr_new(expr expr);
-void          expr_free(expr *NULLABLE expr);
+void    expr_print(program const *NONNULL prog, expr_id e);
+// The byte offset of the root token of the expression
+u32     expr_pos(program const *NONNULL prog, expr_id e);
 
-#define EXPR_NEW(tag, tok, ...) \
-    expr_new((expr){            \
-        tag, lexer_token_clone(tok), {.tag = (struct tag){__VA_ARGS__}}})
+expr_id expr_new(program *NONNULL prog, expr_tag tag, u32 token, u32 lhs,
+                 u32 rhs);
+expr_id expr_binary_new(program *NONNULL prog, u32 token, binary_operator op,
+                        expr_id lhs, expr_id rhs);
+expr_id expr_function_call_new(program *NONNULL prog, u32 token,
+                               expr_id const *NONNULL params, u32 count);
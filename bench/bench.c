@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ast.h"
+#include "bench/generate.h"
+#include "emit_ir.h"
+#include "fold_ir.h"
+#include "intern.h"
+#include "ir.h"
+#include "lexer.h"
+#include "parser.h"
+#include "rbcc.h"
+#include "targets/elf.h"
+#include "targets/targets.h"
+
+// Measures the throughput of the compiler phases on generated sources, every
+// measurement is the best of a number of iterations.
+
+typedef struct options {
+    bool        shapes[SHAPE_MAX];
+    size_t      size;
+    u32         iterations;
+    u64         seed;
+    bool        json;
+    char const *NULLABLE write;
+    char const *NONNULL output;
+} options;
+
+typedef struct result {
+    source_shape shape;
+    size_t       bytes;
+
+    f64          lexer_seconds;
+    size_t       tokens;
+
+    // Only set if the shape parses
+    bool         parses;
+    f64          parser_seconds;
+    size_t       nodes;
+    f64          ir_seconds;
+    size_t       instructions;
+    f64          compile_seconds;
+} result;
+
+static f64 now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (f64)ts.tv_sec + (f64)ts.tv_nsec / 1e9;
+}
+
+static f64 min_f64(f64 lhs, f64 rhs) { return lhs < rhs ? lhs : rhs; }
+
+static f64 bench_lexer(str source, size_t *NONNULL count) {
+    interner   names = {0};
+    line_table lines = {0};
+    lexer     *l     = lexer_new(&names, &lines, S("bench.rbc"), source);
+
+    f64        start = now_seconds();
+    tokens     toks  = lexer_tokenize_all(l);
+    f64        seconds = now_seconds() - start;
+
+    // Without the TEOF
+    *count = toks.count - 1;
+    free(toks.items);
+    lexer_free(l);
+    interner_free(&names);
+    line_table_free(&lines);
+    return seconds;
+}
+
+// Only the parsing, the tokens are scanned before
+static f64 bench_parser(str source) {
+    interner   names     = {0};
+    line_table lines     = {0};
+    arena      ast_arena = {0};
+    lexer     *l         = lexer_new(&names, &lines, S("bench.rbc"), source);
+    parser    *p         = parser_new(l, &ast_arena);
+
+    f64        start     = now_seconds();
+    program   *prog      = parse_program(p);
+    f64        seconds   = now_seconds() - start;
+
+    program_free(prog);
+    parser_free(p);
+    lexer_free(l);
+    arena_free(&ast_arena);
+    interner_free(&names);
+    line_table_free(&lines);
+    return seconds;
+}
+
+static f64 bench_ir(str source, size_t *NONNULL instructions) {
+    interner   names     = {0};
+    line_table lines     = {0};
+    arena      ast_arena = {0}, ir_arena = {0};
+    lexer     *l         = lexer_new(&names, &lines, S("bench.rbc"), source);
+    parser    *p         = parser_new(l, &ast_arena);
+    program   *prog      = parse_program(p);
+
+    f64        start     = now_seconds();
+    ir_program ir        = ir_emit_program(&ir_arena, prog);
+    f64        seconds   = now_seconds() - start;
+
+    *instructions        = ir.main_function->instructions.len;
+    program_free(prog);
+    parser_free(p);
+    lexer_free(l);
+    arena_free(&ast_arena);
+    arena_free(&ir_arena);
+    interner_free(&names);
+    line_table_free(&lines);
+    return seconds;
+}
+
+// Everything main does for a internally linked executable, without reading
+// the input and printing
+static f64 bench_compile(str source, char const *NONNULL output) {
+    interner   names     = {0};
+    line_table lines     = {0};
+    arena      ast_arena = {0}, ir_arena = {0};
+    elf_object obj       = {0};
+
+    f64        start     = now_seconds();
+    lexer     *l         = lexer_new(&names, &lines, S("bench.rbc"), source);
+    parser    *p         = parser_new(l, &ast_arena);
+    program   *prog      = parse_program(p);
+    ir_program ir        = ir_emit_program(&ir_arena, prog);
+    program_free(prog);
+    parser_free(p);
+    lexer_free(l);
+    arena_free(&ast_arena);
+    bool ok = ir_fold_program(&ir_arena, &ir);
+    if (ok) {
+        code_gen_object(TARGET_X86_64_LINUX, ir, &obj);
+        ok = link_executable(output, TARGET_X86_64_LINUX, &obj, 1, S("main"));
+    }
+    f64 seconds = now_seconds() - start;
+
+    if (!ok) {
+        fprintf(stderr, "failed to compile the benchmark source\n");
+        exit(1);
+    }
+    remove(output);
+    elf_object_free(obj);
+    arena_free(&ir_arena);
+    interner_free(&names);
+    line_table_free(&lines);
+    return seconds;
+}
+
+static result run_benchmark(options const *NONNULL opts, source_shape shape) {
+    generated_source gen = generate_source(shape, opts->size, opts->seed);
+    result           r   = {
+        .shape           = shape,
+        .bytes           = gen.source.len,
+        .parses          = source_shape_parses(shape),
+        .nodes           = gen.nodes,
+        .lexer_seconds   = 1e300,
+        .parser_seconds  = 1e300,
+        .ir_seconds      = 1e300,
+        .compile_seconds = 1e300,
+    };
+
+    for (u32 i = 0; i < opts->iterations; i++) {
+        r.lexer_seconds =
+            min_f64(r.lexer_seconds, bench_lexer(gen.source, &r.tokens));
+        if (!r.parses) {
+            continue;
+        }
+        r.parser_seconds = min_f64(r.parser_seconds, bench_parser(gen.source));
+        r.ir_seconds =
+            min_f64(r.ir_seconds, bench_ir(gen.source, &r.instructions));
+        r.compile_seconds =
+            min_f64(r.compile_seconds, bench_compile(gen.source, opts->output));
+    }
+
+    str_free(gen.source);
+    return r;
+}
+
+static void print_table_header(void) {
+    printf("%-10s %10s %12s %14s %14s %12s\n", "shape", "bytes", "lexer MB/s",
+           "parser nodes/s", "ir insts/s", "compile ms");
+}
+
+static void print_table_row(result const *NONNULL r) {
+    printf("%-10s %10zu %12.2f", source_shape_str(r->shape), r->bytes,
+           (f64)r->bytes / 1e6 / r->lexer_seconds);
+    if (r->parses) {
+        printf(" %14.0f %14.0f %12.3f\n", (f64)r->nodes / r->parser_seconds,
+               (f64)r->instructions / r->ir_seconds,
+               r->compile_seconds * 1000.0);
+    } else {
+        printf(" %14s %14s %12s\n", "-", "-", "-");
+    }
+}
+
+static void print_json(options const *NONNULL opts,
+                       result const *NONNULL results, size_t count) {
+    printf("{\n  \"size\": %zu,\n  \"iterations\": %u,\n  \"seed\": %lu,\n",
+           opts->size, opts->iterations, opts->seed);
+    printf("  \"benchmarks\": [\n");
+    for (size_t i = 0; i < count; i++) {
+        result const *r = &results[i];
+        printf("    {\n      \"shape\": \"%s\",\n      \"bytes\": %zu,\n",
+               source_shape_str(r->shape), r->bytes);
+        printf("      \"lexer\": {\"seconds\": %.9f, \"tokens\": %zu, "
+               "\"mb_per_s\": %.3f},\n",
+               r->lexer_seconds, r->tokens,
+               (f64)r->bytes / 1e6 / r->lexer_seconds);
+        if (r->parses) {
+            printf("      \"parser\": {\"seconds\": %.9f, \"nodes\": %zu, "
+                   "\"nodes_per_s\": %.1f},\n",
+                   r->parser_seconds, r->nodes,
+                   (f64)r->nodes / r->parser_seconds);
+            printf("      \"ir\": {\"seconds\": %.9f, \"instructions\": %zu, "
+                   "\"instructions_per_s\": %.1f},\n",
+                   r->ir_seconds, r->instructions,
+                   (f64)r->instructions / r->ir_seconds);
+            printf("      \"compile\": {\"seconds\": %.9f}\n",
+                   r->compile_seconds);
+        } else {
+            printf("      \"parser\": null,\n      \"ir\": null,\n"
+                   "      \"compile\": null\n");
+        }
+        printf("    }%s\n", i + 1 < count ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+static void print_help(int exit_code) {
+    printf("rbc-bench [OPTIONS]\n");
+    printf("  --help            # Print this help\n");
+    printf("  --shape=NAME      # Only run the shape deep, idents, functions, "
+           "utf8 or strings, can be repeated (default all)\n");
+    printf("  --size=BYTES      # Size of the generated sources, accepts k and "
+           "m suffixes (default 1m)\n");
+    printf("  --iterations=N    # Report the best of N runs (default 5)\n");
+    printf("  --seed=N          # Seed of the generator\n");
+    printf("  --json            # Print the results as json\n");
+    printf("  --write=FILE      # Write the source of the shape to FILE and "
+           "exit, instead of running the benchmarks\n");
+    printf("  --output=FILE     # The executable written by the compile "
+           "benchmark (default build/bench.out)\n");
+    exit(exit_code);
+}
+
+// Returns the value of a --name=value argument, or NULL if arg is not name
+static char const *NULLABLE option_value(char const *NONNULL arg,
+                                         char const *NONNULL name) {
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) == 0 && arg[len] == '=') {
+        return arg + len + 1;
+    }
+    return NULL;
+}
+
+static size_t parse_size(char const *NONNULL value) {
+    char  *end;
+    size_t size = strtoull(value, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+        size *= 1024;
+    } else if (*end == 'm' || *end == 'M') {
+        size *= 1024 * 1024;
+    } else if (*end != 0) {
+        printf("invalid size \"%s\"\n", value);
+        print_help(1);
+    }
+    return size;
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    options opts = {
+        .size       = 1024 * 1024,
+        .iterations = 5,
+        .seed       = 1,
+        .output     = "build/bench.out",
+    };
+    bool any_shape = false;
+    for (argv += 1; *argv != NULL; argv++) {
+        char const *value;
+        if (strcmp(*argv, "--help") == 0) {
+            print_help(0);
+        } else if (strcmp(*argv, "--json") == 0) {
+            opts.json = true;
+        } else if ((value = option_value(*argv, "--shape"))) {
+            source_shape shape = source_shape_from_str(
+                (str){.data = (u8 *)value, .len = strlen(value)});
+            if (shape == SHAPE_MAX) {
+                printf("unknown shape \"%s\"\n", value);
+                print_help(1);
+            }
+            opts.shapes[shape] = true;
+            any_shape          = true;
+        } else if ((value = option_value(*argv, "--size"))) {
+            opts.size = parse_size(value);
+        } else if ((value = option_value(*argv, "--iterations"))) {
+            opts.iterations = (u32)strtoul(value, NULL, 10);
+            if (opts.iterations == 0) {
+                opts.iterations = 1;
+            }
+        } else if ((value = option_value(*argv, "--seed"))) {
+            opts.seed = strtoull(value, NULL, 10);
+        } else if ((value = option_value(*argv, "--write"))) {
+            opts.write = value;
+        } else if ((value = option_value(*argv, "--output"))) {
+            opts.output = value;
+        } else {
+            printf("unknown option \"%s\"\n", *argv);
+            print_help(1);
+        }
+    }
+    if (!any_shape) {
+        for (size_t i = 0; i < SHAPE_MAX; i++) {
+            opts.shapes[i] = true;
+        }
+    }
+
+    if (opts.write) {
+        source_shape shape = 0;
+        while (!opts.shapes[shape]) {
+            shape++;
+        }
+        generated_source gen = generate_source(shape, opts.size, opts.seed);
+        bytes contents = {.items = gen.source.data, .count = gen.source.len};
+        bool  ok       = write_file(opts.write, contents);
+        str_free(gen.source);
+        return ok ? 0 : 1;
+    }
+
+    result results[SHAPE_MAX];
+    size_t count = 0;
+    if (!opts.json) {
+        print_table_header();
+    }
+    for (source_shape shape = 0; shape < SHAPE_MAX; shape++) {
+        if (!opts.shapes[shape]) {
+            continue;
+        }
+        results[count] = run_benchmark(&opts, shape);
+        if (!opts.json) {
+            print_table_row(&results[count]);
+            fflush(stdout);
+        }
+        count++;
+    }
+    if (opts.json) {
+        print_json(&opts, results, count);
+    }
+    return 0;
+}
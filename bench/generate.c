@@ -0,0 +1,169 @@
+#include "bench/generate.h"
+#include <stdlib.h>
+#include <string.h>
+#include "rbcc.h"
+
+static char const *const shape_strs[] = {
+    [SHAPE_DEEP]      = "deep",
+    [SHAPE_IDENTS]    = "idents",
+    [SHAPE_FUNCTIONS] = "functions",
+    [SHAPE_UTF8]      = "utf8",
+    [SHAPE_STRINGS]   = "strings",
+};
+
+char const *NONNULL source_shape_str(source_shape shape) {
+    if (shape >= SHAPE_MAX) {
+        return "unknown";
+    }
+    return shape_strs[shape];
+}
+
+source_shape source_shape_from_str(str name) {
+    for (source_shape shape = 0; shape < SHAPE_MAX; shape++) {
+        if (str_eq(name, (str){.data = (u8 *)shape_strs[shape],
+                               .len  = strlen(shape_strs[shape])})) {
+            return shape;
+        }
+    }
+    return SHAPE_MAX;
+}
+
+bool source_shape_parses(source_shape shape) { return shape == SHAPE_DEEP; }
+
+// xorshift64, good enough to vary the sources
+static u64 next_random(u64 *NONNULL state) {
+    u64 x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void append(bytes *NONNULL out, char const *NONNULL text) {
+    bytes_append(out, text, strlen(text));
+}
+
+static void append_number(bytes *NONNULL out, u64 *NONNULL rng) {
+    char buffer[32];
+    int  len = snprintf(buffer, sizeof(buffer), "%u",
+                        (unsigned)(next_random(rng) % 999 + 1));
+    bytes_append(out, buffer, (size_t)len);
+}
+
+static void append_ident(bytes *NONNULL out, u64 *NONNULL rng, bool utf8) {
+    static char const *const ascii[] = {"a", "b", "x", "y", "n", "q", "z",
+                                        "k", "1", "7"};
+    // Latin-1, greek, cyrillic, cjk and hiragana letters
+    static char const *const multibyte[] = {"ä", "ß", "λ", "Ω", "ж",
+                                            "я", "变", "量", "あ", "ç"};
+    // Identifiers start with a letter
+    append(out, utf8 ? multibyte[next_random(rng) % 10] : "v");
+    size_t len = 3 + next_random(rng) % 12;
+    for (size_t i = 0; i < len; i++) {
+        u64 r = next_random(rng);
+        append(out, utf8 && r % 2 ? multibyte[r / 2 % 10] : ascii[r / 2 % 10]);
+    }
+}
+
+// Terms are single constants or products/quotients of two small constants,
+// so that folding them never overflows
+static void generate_deep(bytes *NONNULL out, size_t size, u64 *NONNULL rng,
+                          size_t *NONNULL nodes) {
+    static char const *const sum_ops[]     = {" + ", " - "};
+    static char const *const product_ops[] = {" * ", " / "};
+    append(out, "fn main() = ");
+    // The program and the function
+    *nodes = 2;
+    for (size_t i = 0; out->count < size || i == 0; i++) {
+        if (i > 0) {
+            append(out, sum_ops[next_random(rng) % 2]);
+            *nodes += 1;
+        }
+        append_number(out, rng);
+        *nodes += 1;
+        if (next_random(rng) % 2) {
+            append(out, product_ops[next_random(rng) % 2]);
+            append_number(out, rng);
+            *nodes += 2;
+        }
+        if (i % 8 == 7) {
+            append(out, "\n    ");
+        }
+    }
+    append(out, ";\n");
+}
+
+static void generate_idents(bytes *NONNULL out, size_t size, u64 *NONNULL rng,
+                            bool utf8) {
+    for (size_t i = 0; out->count < size; i++) {
+        append_ident(out, rng, utf8);
+        append(out, i % 10 == 9 ? "\n" : " ");
+    }
+}
+
+static void generate_functions(bytes *NONNULL out, size_t size,
+                               u64 *NONNULL rng) {
+    while (out->count < size) {
+        append(out, "fn ");
+        append_ident(out, rng, false);
+        append(out, "() = ");
+        append_number(out, rng);
+        append(out, " + ");
+        append_number(out, rng);
+        append(out, " * ");
+        append_number(out, rng);
+        append(out, ";\n");
+    }
+}
+
+static void generate_strings(bytes *NONNULL out, size_t size,
+                             u64 *NONNULL rng) {
+    static char const *const words[] = {"lorem", "ipsum",  "dolor",
+                                        "sit",   "amet",   "consectetur",
+                                        "elit",  "tempor", "labore"};
+    while (out->count < size) {
+        size_t indent = 4 * (1 + next_random(rng) % 8);
+        for (size_t i = 0; i < indent; i++) {
+            append(out, " ");
+        }
+        append(out, "\"");
+        size_t len = 8 + next_random(rng) % 24;
+        for (size_t i = 0; i < len; i++) {
+            append(out, words[next_random(rng) % 9]);
+            append(out, i % 12 == 11 ? "\n" : " ");
+        }
+        append(out, "\"\n");
+    }
+}
+
+generated_source generate_source(source_shape shape, size_t size, u64 seed) {
+    bytes  out   = {0};
+    size_t nodes = 0;
+    u64    rng   = seed ? seed : 0x9e3779b97f4a7c15;
+    switch (shape) {
+        case SHAPE_DEEP:
+            generate_deep(&out, size, &rng, &nodes);
+            break;
+        case SHAPE_IDENTS:
+            generate_idents(&out, size, &rng, false);
+            break;
+        case SHAPE_FUNCTIONS:
+            generate_functions(&out, size, &rng);
+            break;
+        case SHAPE_UTF8:
+            generate_idents(&out, size, &rng, true);
+            break;
+        case SHAPE_STRINGS:
+            generate_strings(&out, size, &rng);
+            break;
+        case SHAPE_MAX:
+            break;
+    }
+    size_t len = out.count;
+    bytes_u8(&out, 0);
+    return (generated_source){
+        .source = {.data = out.items, .len = len},
+        .nodes  = nodes,
+    };
+}
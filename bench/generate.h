@@ -0,0 +1,38 @@
+#pragma once
+
+#include "rbcc.h"
+
+// Generates synthetic rbc sources of a given size and shape, for the
+// benchmarks. The output is deterministic for a seed.
+
+typedef enum source_shape {
+    // One function with a long chain of binary expressions, which parses
+    // into a left deep tree
+    SHAPE_DEEP,
+    // A stream of ascii identifiers
+    SHAPE_IDENTS,
+    // Many small functions
+    SHAPE_FUNCTIONS,
+    // A stream of identifiers with multibyte utf8 characters
+    SHAPE_UTF8,
+    // Deeply indented lines of long string literals
+    SHAPE_STRINGS,
+    SHAPE_MAX,
+} source_shape;
+
+char const *NONNULL source_shape_str(source_shape shape);
+// Returns SHAPE_MAX if the name is unknown
+source_shape        source_shape_from_str(str name);
+// The parser only accepts a single function, the other shapes can only be
+// lexed.
+bool                source_shape_parses(source_shape shape);
+
+typedef struct generated_source {
+    str    source; // owned, use str_free
+    // The number of ast nodes parse_program creates for it, 0 if the shape
+    // does not parse
+    size_t nodes;
+} generated_source;
+
+// Generates at least size bytes
+generated_source generate_source(source_shape shape, size_t size, u64 seed);
@@ -4,21 +4,48 @@
 --> Build Configuration --
 local files = {
 	"main.c",
+	"arena.c",
+	"intern.c",
 	"lexer.c",
+	"lexer_scan.c",
 	"utf8proc.c",
 	"str.c",
 	"ast.c",
 	"parser.c",
 	"ir.c",
 	"emit_ir.c",
+	"fold_ir.c",
+	"interpret_ir.c",
 	"files.c",
+	"passes.c",
+	"rbc.c",
+	"server.c",
+	"cache.c",
+	"targets/elf.c",
+	"targets/jit.c",
+	"targets/x86_64-encode.c",
 	"targets/x86_64-linux.c",
+	"targets/x86_64-regalloc.c",
 	"targets/targets.c",
 }
 local target = "build/rbc"
+-- The benchmarks link against everything in files, except main.c
+local bench_files = {
+	"bench/bench.c",
+	"bench/generate.c",
+}
+local bench_target = "build/rbc-bench"
+-- The test programs link against everything in files, except main.c, tests.py
+-- runs them
+local test_programs = {
+	-- The library api
+	{ target = "build/rbc-api-test", files = { "tests/api/compile_buffer.c" } },
+	-- The register allocator, with more live values than registers
+	{ target = "build/rbc-regalloc-test", files = { "tests/regalloc/spill.c" } },
+}
 local compiler = "clang"
 local cflags = "-g -std=c11 -O2 -Wall -Wextra -Wpedantic -I."
-local ldflags = ""
+local ldflags = "-pthread"
 --< Build Configuration --
 
 -- Build Logic
@@ -72,12 +99,37 @@ var("ldflags", ldflags) -- Flags passed to gcc when linking
 local files_to_build = {}
 ---@type string[]
 local object_files = {}
+---@type string[]
+local bench_object_files = {}
+---@type string[]
+local library_object_files = {}
 
 for _, file in ipairs(files) do
 	local object_file = "build/" .. file:gsub("%.c", ".o")
 
 	table.insert(files_to_build, { input = file, output = object_file })
 	table.insert(object_files, object_file)
+	if file ~= "main.c" then
+		table.insert(bench_object_files, object_file)
+		table.insert(library_object_files, object_file)
+	end
+end
+
+for _, file in ipairs(bench_files) do
+	local object_file = "build/" .. file:gsub("%.c", ".o")
+
+	table.insert(files_to_build, { input = file, output = object_file })
+	table.insert(bench_object_files, object_file)
+end
+
+for _, program in ipairs(test_programs) do
+	program.object_files = {}
+	for _, file in ipairs(program.files) do
+		local object_file = "build/" .. file:gsub("%.c", ".o")
+
+		table.insert(files_to_build, { input = file, output = object_file })
+		table.insert(program.object_files, object_file)
+	end
 end
 
 var("builddir", "build/")
@@ -99,6 +151,7 @@ for _, to_build in ipairs(files_to_build) do
 end
 
 build(target, object_files, ld)
+build(bench_target, bench_object_files, ld)
 
 local function copy_table(t)
 	local u = {}
@@ -110,6 +163,15 @@ end
 
 local all = copy_table(files)
 table.insert(all, target)
+table.insert(all, bench_target)
+for _, program in ipairs(test_programs) do
+	local inputs = copy_table(library_object_files)
+	for _, object_file in ipairs(program.object_files) do
+		table.insert(inputs, object_file)
+	end
+	build(program.target, inputs, ld)
+	table.insert(all, program.target)
+end
 build("all", all, "phony")
 
 build("compile_commands.json", { "all" }, compdb)
@@ -0,0 +1,219 @@
+#if defined(__linux__) || defined(__unix__)
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAS_CACHE 1
+#else
+#define HAS_CACHE 0
+#endif
+#include "cache.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "da.h"
+#include "rbcc.h"
+
+cache_hasher cache_hasher_new(void) {
+    return (cache_hasher){.hi = 0x6c62272e07bb0142, .lo = 0x62b821756295c58d};
+}
+
+void cache_hash(cache_hasher *NONNULL h, void const *NULLABLE data,
+                size_t len) {
+    // The prime is 2^88 + 0x13b, so the product is the state times 0x13b plus
+    // the low half shifted into the high half
+    u64 const prime_lo = 0x13b;
+    u8 const *p        = data;
+    u64       hi       = h->hi;
+    u64       lo       = h->lo;
+    for (size_t i = 0; i < len; i++) {
+        lo         ^= p[i];
+        u64 lo_lo   = (lo & 0xffffffff) * prime_lo;
+        u64 lo_hi   = (lo >> 32) * prime_lo;
+        u64 mid     = (lo_lo >> 32) + (lo_hi & 0xffffffff);
+        u64 carry   = (lo_hi >> 32) + (mid >> 32);
+        hi          = hi * prime_lo + carry + (lo << 24);
+        lo          = (mid << 32) | (lo_lo & 0xffffffff);
+    }
+    h->hi = hi;
+    h->lo = lo;
+}
+
+void cache_hash_u64(cache_hasher *NONNULL h, u64 value) {
+    u8 buffer[8];
+    for (size_t i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = (u8)(value >> (8 * i));
+    }
+    cache_hash(h, buffer, sizeof(buffer));
+}
+
+cache_key cache_hasher_key(cache_hasher const *NONNULL h) {
+    return (cache_key){.hi = h->hi, .lo = h->lo};
+}
+
+#if HAS_CACHE
+
+void cache_hash_compiler(cache_hasher *NONNULL h) {
+    struct stat st;
+    if (stat("/proc/self/exe", &st) == 0) {
+        cache_hash_u64(h, (u64)st.st_dev);
+        cache_hash_u64(h, (u64)st.st_ino);
+        cache_hash_u64(h, (u64)st.st_size);
+        cache_hash_u64(h, (u64)st.st_mtim.tv_sec);
+        cache_hash_u64(h, (u64)st.st_mtim.tv_nsec);
+        return;
+    }
+    char const *built = __DATE__ " " __TIME__;
+    cache_hash(h, built, strlen(built));
+}
+
+static str entry_path(char const *NONNULL dir, cache_key key) {
+    return alloc_print_str("%s/%016" PRIx64 "%016" PRIx64, dir, key.hi, key.lo);
+}
+
+// Copies the file, the destination is executable
+static bool copy_file(char const *NONNULL from, char const *NONNULL to) {
+    source_file file;
+    if (!read_source_file(from, &file)) {
+        return false;
+    }
+    bytes content = {.items    = file.contents.data,
+                     .count    = file.contents.len,
+                     .capacity = file.contents.len};
+    bool  ok      = write_file(to, content) && make_executable(to);
+    source_file_free(file);
+    return ok;
+}
+
+bool cache_fetch(char const *NONNULL dir, cache_key key,
+                 char const *NONNULL output_file) {
+    str  path = entry_path(dir, key);
+    bool ok   = access((char const *)path.data, F_OK) == 0 &&
+              copy_file((char const *)path.data, output_file);
+    if (ok) {
+        // The time of the last use, for the eviction
+        utimensat(AT_FDCWD, (char const *)path.data, NULL, 0);
+    }
+    str_free(path);
+    return ok;
+}
+
+typedef struct cache_entry {
+    str    path;
+    u64    size;
+    time_t used;
+    long   used_nsec;
+} cache_entry;
+
+typedef struct cache_entries {
+    cache_entry *NULLABLE items;
+    size_t                count;
+    size_t                capacity;
+} cache_entries;
+
+static int compare_used(void const *NONNULL lhs, void const *NONNULL rhs) {
+    cache_entry const *a = lhs;
+    cache_entry const *b = rhs;
+    if (a->used != b->used) {
+        return a->used < b->used ? -1 : 1;
+    }
+    return (a->used_nsec > b->used_nsec) - (a->used_nsec < b->used_nsec);
+}
+
+// Removes the least recently used entries, until the entries are at most
+// max_size
+static void evict(char const *NONNULL dir, u64 max_size) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return;
+    }
+    cache_entries  entries = {0};
+    u64            total   = 0;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        // The entries are named by their 32 hex digits, everything else is
+        // not ours or still being written
+        if (strlen(ent->d_name) != 32) {
+            continue;
+        }
+        str         path = alloc_print_str("%s/%s", dir, ent->d_name);
+        struct stat st;
+        if (stat((char const *)path.data, &st) != 0 || !S_ISREG(st.st_mode)) {
+            str_free(path);
+            continue;
+        }
+        cache_entry entry = {
+            .path      = path,
+            .size      = (u64)st.st_size,
+            .used      = st.st_mtim.tv_sec,
+            .used_nsec = st.st_mtim.tv_nsec,
+        };
+        da_append(&entries, entry);
+        CHECK_ALLOC(entries.items);
+        total += entry.size;
+    }
+    closedir(d);
+
+    if (total > max_size) {
+        qsort(entries.items, entries.count, sizeof(cache_entry), compare_used);
+        for (size_t i = 0; i < entries.count && total > max_size; i++) {
+            if (unlink((char const *)entries.items[i].path.data) == 0) {
+                total -= entries.items[i].size;
+            }
+        }
+    }
+    for (size_t i = 0; i < entries.count; i++) {
+        str_free(entries.items[i].path);
+    }
+    da_free(&entries);
+}
+
+void cache_store(char const *NONNULL dir, cache_key key,
+                 char const *NONNULL output_file, u64 max_size) {
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "could not create the cache directory %s: %s\n", dir,
+                strerror(errno));
+        return;
+    }
+    // Written to a temporary file first, so other compilers never read a
+    // partial entry
+    str path = entry_path(dir, key);
+    str temp = alloc_print_str("%s.%ld.tmp", path.data, (long)getpid());
+    if (copy_file(output_file, (char const *)temp.data) &&
+        rename((char const *)temp.data, (char const *)path.data) == 0) {
+        evict(dir, max_size);
+    } else {
+        remove((char const *)temp.data);
+    }
+    str_free(temp);
+    str_free(path);
+}
+
+#else
+
+void cache_hash_compiler(cache_hasher *NONNULL h) {
+    char const *built = __DATE__ " " __TIME__;
+    cache_hash(h, built, strlen(built));
+}
+
+bool cache_fetch(char const *NONNULL dir, cache_key key,
+                 char const *NONNULL output_file) {
+    (void)dir;
+    (void)key;
+    (void)output_file;
+    return false;
+}
+
+void cache_store(char const *NONNULL dir, cache_key key,
+                 char const *NONNULL output_file, u64 max_size) {
+    (void)dir;
+    (void)key;
+    (void)output_file;
+    (void)max_size;
+}
+
+#endif
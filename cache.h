@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "rbcc.h"
+
+// A content addressed cache of executables in a directory. Every entry is
+// named by the hash of everything the executable depends on, when the
+// directory grows over its size the least recently used entries are removed.
+
+// The size of the cache directory, if it is not specified
+#define CACHE_MAX_SIZE ((u64)256 << 20)
+
+// FNV-1a with 128 bits, as two halves
+typedef struct cache_hasher {
+    u64 hi, lo;
+} cache_hasher;
+
+typedef struct cache_key {
+    u64 hi, lo;
+} cache_key;
+
+cache_hasher cache_hasher_new(void);
+void cache_hash(cache_hasher *NONNULL h, void const *NULLABLE data, size_t len);
+void cache_hash_u64(cache_hasher *NONNULL h, u64 value);
+// Hashes the identity of the running compiler, a rebuilt compiler does not
+// use the entries of the old one
+void cache_hash_compiler(cache_hasher *NONNULL h);
+cache_key cache_hasher_key(cache_hasher const *NONNULL h);
+
+// Copies the entry of the key to output_file, returns false if there is none
+bool cache_fetch(char const *NONNULL dir, cache_key key,
+                 char const *NONNULL output_file);
+// Copies output_file into the cache as the entry of the key and evicts the
+// least recently used entries, until the directory is at most max_size
+void cache_store(char const *NONNULL dir, cache_key key,
+                 char const *NONNULL output_file, u64 max_size);
@@ -19,4 +19,7 @@ elif [[ $1 = "build" ]]; then
 elif [[ $1 = "test" ]]; then
     export PATH="$(pwd):$PATH"
     python3 tests.py
+elif [[ $1 = "bench" ]]; then
+    export PATH="$(pwd):$PATH"
+    ./build.lua && ./build/rbc-bench --json
 fi
@@ -18,7 +18,7 @@
 #define da_grow(da, item_size)                                                \
     do {                                                                      \
         if ((da)->items != NULL) {                                            \
-            if (((da)->items = realloc(                                       \
+            if (((da)->items = xrealloc(                                      \
                      (da)->items, item_size * (da)->capacity * 2)) == NULL) { \
                 (da)->capacity = 0;                                           \
                 (da)->count    = 0;                                           \
@@ -26,7 +26,8 @@
                 (da)->capacity *= 2;                                          \
             }                                                                 \
         } else {                                                              \
-            if (((da)->items = malloc(item_size * DA_INITIAL_CAP)) == NULL) { \
+            if (((da)->items = xmalloc(item_size * DA_INITIAL_CAP)) ==        \
+                NULL) {                                                       \
                 (da)->capacity = 0;                                           \
                 (da)->count    = 0;                                           \
             } else {                                                          \
@@ -54,6 +55,22 @@
                (list)->count * sizeof(*(list)->items));   \
     } while (0);
 
+// Like da_append, but the items are allocated from a arena (see rbcc.h)
+// instead of the heap, so the da must not be freed with da_free.
+#define arena_da_append(arena, da, item)                                  \
+    do {                                                                  \
+        if ((da)->count >= (da)->capacity) {                              \
+            size_t new_cap =                                              \
+                (da)->capacity == 0 ? DA_INITIAL_CAP : (da)->capacity * 2; \
+            (da)->items = arena_realloc(                                  \
+                (arena), (da)->items,                                     \
+                sizeof(*(da)->items) * (da)->capacity,                    \
+                sizeof(*(da)->items) * new_cap);                          \
+            (da)->capacity = new_cap;                                     \
+        }                                                                 \
+        (da)->items[((da)->count)++] = item;                              \
+    } while (0);
+
 #define da_pop(da)                     \
     do {                               \
         (da)->count = (da)->count - 1; \
@@ -2,101 +2,130 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "ast.h"
+#include "da.h"
 #include "ir.h"
 #include "rbcc.h"
 
-ir_value *make_temp(void) {
-    str temp = str_unique();
-    return IR_VALUE_NEW(value_temp, temp);
-}
+// A expression on the work stack, a binary expression is visited twice, once
+// to push its operands and once to emit it after them
+typedef struct emit_work {
+    expr_id e;
+    bool    operands_done;
+} emit_work;
 
-ir_value *make_copy(ir_value *ptr) {
-    ir_value value = *ptr;
-    switch (value.tag) {
-        case value_constant: {
-            /*struct value_constant data = value.data.value_constant;*/
-            return ptr;
-        }
-        case value_temp: {
-            struct value_temp data = value.data.value_temp;
-            return IR_VALUE_NEW(value_temp, str_clone(data.value));
-        }
-    }
-}
+typedef struct emit_stack {
+    emit_work *NULLABLE items;
+    size_t              count;
+    size_t              capacity;
+} emit_stack;
 
-typedef struct ir_expr {
-    ir_instructions   insts;
-    ir_value *NONNULL result;
-} ir_expr;
+typedef struct ir_values {
+    ir_value *NULLABLE items;
+    size_t             count;
+    size_t             capacity;
+} ir_values;
 
-ir_expr ir_emit_expr(expr *ptr) {
-    expr e = *ptr;
-    switch (e.tag) {
-        case expr_constant: {
-            struct expr_constant data = e.data.expr_constant;
-            return (ir_expr){
-                .insts  = {0},
-                .result = IR_VALUE_NEW(value_constant, data.value),
-            };
-        }
-        case expr_binary: {
-            struct expr_binary     data     = e.data.expr_binary;
-
-            ir_instructions_buffer buffer   = ir_instructions_buffer_new(1);
-
-            ir_expr                lhs_expr = ir_emit_expr(data.lhs);
-            ir_instructions_buffer_append(&buffer, lhs_expr.insts);
-            ir_expr                rhs_expr = ir_emit_expr(data.rhs);
-            ir_instructions_buffer_append(&buffer, rhs_expr.insts);
+typedef struct ir_emitter {
+    arena *NONNULL         arena;
+    program const *NONNULL prog;
+    // The number of vregs used by the current function
+    u32                    vreg_count;
+    // The instructions of the current function
+    ir_instructions_buffer insts;
+    // The expressions that are still to be emitted and the results of the
+    // emitted ones, both are kept between functions
+    emit_stack             work;
+    ir_values              values;
+} ir_emitter;
 
-            ir_value              *lhs      = make_copy(lhs_expr.result);
-            ir_value              *rhs      = make_copy(rhs_expr.result);
-            ir_value              *dst      = make_temp();
+// The instruction of every binary operator
+static enum ir_instruction_kind const binary_insts[BOP_MAX] = {
+    [BOP_ADD] = INST_ADD,
+    [BOP_SUB] = INST_SUB,
+    [BOP_MUL] = INST_MUL,
+    [BOP_DIV] = INST_DIV,
+};
 
-            ir_instructions_buffer_push(
-                &buffer,
-                ir_instruction_new(data.op + INST_ADD, lhs, rhs, dst));
+ir_value make_temp(ir_emitter *NONNULL em) {
+    return IR_VALUE(value_temp, em->vreg_count++);
+}
 
-            return (ir_expr){.insts  = ir_instructions_new(buffer),
-                             .result = make_copy(dst)};
+// Appends the instructions of the expression to the function and returns its
+// result. The tree is walked with a explicit stack, so deep expressions
+// don't overflow the call stack.
+static ir_value ir_emit_expr(ir_emitter *NONNULL em, expr_id root) {
+    exprs const *x = &em->prog->exprs;
+    da_append(&em->work, ((emit_work){root, false}));
+    while (em->work.count > 0) {
+        emit_work w = em->work.items[--em->work.count];
+        switch ((expr_tag)x->tags[w.e]) {
+            case expr_constant: {
+                i64 value = em->prog->constants.items[x->lhs[w.e]];
+                da_append(&em->values, IR_VALUE(value_constant, value));
+                break;
+            }
+            case expr_binary: {
+                if (!w.operands_done) {
+                    // The lhs is popped and emitted first
+                    da_append(&em->work, ((emit_work){w.e, true}));
+                    da_append(&em->work, ((emit_work){x->rhs[w.e], false}));
+                    da_append(&em->work, ((emit_work){x->lhs[w.e], false}));
+                    break;
+                }
+                ir_value rhs = em->values.items[--em->values.count];
+                ir_value lhs = em->values.items[--em->values.count];
+                ir_value dst = make_temp(em);
+                ir_instructions_buffer_push(
+                    &em->insts,
+                    ir_instruction_new(binary_insts[x->ops[w.e]], lhs, rhs,
+                                       dst, expr_pos(em->prog, w.e)));
+                da_append(&em->values, dst);
+                break;
+            }
+            case expr_string:
+            case expr_function_call:
+                printf("Reached unimplemented expr ir emitission");
+                da_append(&em->values, IR_VALUE(value_constant, 0));
+                break;
         }
-        case expr_string:
-        case expr_function_call:
-            printf("Reached unimplemented expr ir emitission");
-            return (ir_expr){
-                .insts =
-                    {
-                            .data = NULL,
-                            .len  = 0,
-                            },
-                .result = IR_VALUE_NEW(value_constant, 0),
-            };
     }
+    return em->values.items[--em->values.count];
 }
 
-ir_function *NONNULL ir_emit_function(stmt *ptr) {
+ir_function *NONNULL ir_emit_function(ir_emitter *NONNULL em, stmt *ptr) {
     stmt s = *ptr;
     switch (s.tag) {
         case stmt_function: {
-            struct stmt_function   data = s.data.stmt_function;
-            ir_expr                expr = ir_emit_expr(data.body);
-            ir_instructions_buffer b    = ir_instructions_buffer_new(1);
-            ir_instructions_buffer_append(&b, expr.insts);
+            struct stmt_function data   = s.data.stmt_function;
+            em->vreg_count              = 0;
+            em->insts                   = (ir_instructions_buffer){0};
+            ir_value             result = ir_emit_expr(em, data.body);
             ir_instructions_buffer_push(
-                &b, ir_instruction_new(INST_RET, expr.result, NULL, NULL));
+                &em->insts, ir_instruction_new(INST_RET, result, (ir_value){0},
+                                               (ir_value){0},
+                                               expr_pos(em->prog, data.body)));
 
-            ir_instructions insts = ir_instructions_new(b);
+            ir_instructions insts = ir_instructions_new(em->arena, em->insts);
+            em->insts             = (ir_instructions_buffer){0};
 
-            ir_function    *ptr   = xmalloc(sizeof(ir_function));
-            *ptr                  = (ir_function){.name         = str_clone(data.name),
-                                                  .instructions = insts};
+            ir_function    *ptr   = arena_alloc(em->arena, sizeof(ir_function));
+            *ptr = (ir_function){.name         = data.name,
+                                 .instructions = insts,
+                                 .vreg_count   = em->vreg_count};
             return ptr;
         }
     }
+    return NULL;
 }
 
-ir_program ir_emit_program(program *NONNULL prog) {
-    return (ir_program){
-        .main_function = ir_emit_function(prog->main_function),
+ir_program ir_emit_program(arena *NONNULL a, program *NONNULL prog) {
+    ir_emitter em = {.arena = a, .prog = prog, .vreg_count = 0};
+    ir_program ir = {
+        .main_function = ir_emit_function(&em, prog->main_function),
+        .names         = prog->names,
+        .lines         = prog->lines,
     };
+    da_free(&em.work);
+    da_free(&em.values);
+    return ir;
 }
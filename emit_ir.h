@@ -3,4 +3,6 @@
 #include "ast.h"
 #include "ir.h"
 
-ir_program ir_emit_program(program *NONNULL prog);
+// The ir is allocated in the arena, it does not reference the ast, but it
+// shares the interner of the program.
+ir_program ir_emit_program(arena *NONNULL a, program *NONNULL prog);
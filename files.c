@@ -1,3 +1,15 @@
+#if defined(__linux__) || defined(__unix__)
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAS_MMAP 1
+#else
+#define HAS_MMAP 0
+#endif
+#include <errno.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -43,3 +55,140 @@ str file_name_with_suffix(str file_name, str suffix) {
     buffer[to_allocate - 1] = 0;
     return (str){.data = buffer, .len = to_allocate - 1};
 }
+
+bool write_file(char const *NONNULL file_name, bytes content) {
+    errno      = 0;
+    FILE *file = fopen(file_name, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    size_t written = fwrite(content.items, 1, content.count, file);
+    if (fclose(file) != 0 || written != content.count) {
+        return false;
+    }
+    return true;
+}
+
+bool make_executable(char const *NONNULL file_name) {
+#if defined(__linux__) || defined(__unix__)
+    errno = 0;
+    struct stat st;
+    if (stat(file_name, &st) != 0) {
+        return false;
+    }
+    return chmod(file_name, st.st_mode | S_IXUSR | S_IXGRP | S_IXOTH) == 0;
+#else
+    (void)file_name;
+    return true;
+#endif
+}
+
+str read_stream(FILE *NONNULL file, size_t size_hint) {
+    // One more for the zero byte
+    size_t capacity = size_hint > 0 ? size_hint + 1 : 4096;
+    u8    *data     = xmalloc(capacity);
+    size_t len      = 0;
+    while (true) {
+        len += fread(data + len, 1, capacity - 1 - len, file);
+        if (len < capacity - 1) {
+            break;
+        }
+        // The buffer is full, which is the end of the stream if the hint was
+        // right
+        int ch = fgetc(file);
+        if (ch == EOF) {
+            break;
+        }
+        capacity *= 2;
+        data      = xrealloc(data, capacity);
+        data[len++] = (u8)ch;
+    }
+    data[len] = 0;
+    return (str){.data = data, .len = len};
+}
+
+#if HAS_MMAP
+// The file is mapped over a reserved region that is one page larger, so
+// there is a zeroed page after the contents even if the size of the file is
+// a multiple of the page size.
+static bool map_source_file(int fd, size_t size, source_file *NONNULL out) {
+    size_t page   = (size_t)sysconf(_SC_PAGESIZE);
+    size_t mapped = (size / page + 1) * page;
+    u8    *base = mmap(NULL, mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                       -1, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    if (mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+        MAP_FAILED) {
+        munmap(base, mapped);
+        return false;
+    }
+    *out = (source_file){
+        .contents = {.data = base, .len = size},
+        .mapped   = mapped,
+    };
+    return true;
+}
+#endif
+
+bool read_source_file(char const *NONNULL file_name, source_file *NONNULL out) {
+    errno = 0;
+#if HAS_MMAP
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return false;
+    }
+    size_t size = S_ISREG(st.st_mode) ? (size_t)st.st_size : 0;
+    if (size > 0 && map_source_file(fd, size, out)) {
+        close(fd);
+        return true;
+    }
+    // Pipes and empty files
+    FILE *file = fdopen(fd, "rb");
+    if (file == NULL) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return false;
+    }
+#else
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    size_t size = 0;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long end = ftell(file);
+        size     = end > 0 ? (size_t)end : 0;
+        rewind(file);
+    }
+#endif
+    *out = (source_file){
+        .contents = read_stream(file, size),
+        .mapped   = 0,
+    };
+    bool ok = !ferror(file);
+    fclose(file);
+    if (!ok) {
+        source_file_free(*out);
+    }
+    return ok;
+}
+
+void source_file_free(source_file file) {
+#if HAS_MMAP
+    if (file.mapped != 0) {
+        munmap(file.contents.data, file.mapped);
+        return;
+    }
+#endif
+    str_free(file.contents);
+}
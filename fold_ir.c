@@ -0,0 +1,188 @@
+#include "fold_ir.h"
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "interpret_ir.h"
+#include "ir.h"
+#include "rbcc.h"
+
+typedef struct folder {
+    // The value each vreg was replaced with, value_none if it was kept
+    ir_value *NONNULL             replacements;
+    bool                          failed;
+    line_table const *NONNULL     lines;
+    fold_report_callback NULLABLE rc;
+    void *NULLABLE                callback_data;
+} folder;
+
+static void PRINTF_FORMAT(4, 5) report(folder *NONNULL f, bool error, u32 pos,
+                   char const *NONNULL fmt, ...) {
+    loc     loc = line_table_loc(f->lines, pos);
+    va_list arg;
+    va_start(arg, fmt);
+    if (f->rc != NULL) {
+        f->rc(f->callback_data, error, loc, fmt, arg);
+    } else {
+        fprintf(stdout, "%s[%d:%d] Optimizer %s ", loc.file.data, loc.line,
+                loc.column, error ? "Error" : "Warning");
+        vfprintf(stdout, fmt, arg);
+        fprintf(stdout, "\n");
+    }
+    va_end(arg);
+    if (error) {
+        f->failed = true;
+    }
+}
+
+static ir_value resolve(folder *NONNULL f, ir_value value) {
+    if (value.tag == value_temp) {
+        ir_value replacement = f->replacements[value.data.value_temp.value];
+        if (replacement.tag != value_none) {
+            return replacement;
+        }
+    }
+    return value;
+}
+
+static bool is_constant(ir_value value, i64 constant) {
+    return value.tag == value_constant &&
+           value.data.value_constant.value == constant;
+}
+
+static bool is_same_temp(ir_value lhs, ir_value rhs) {
+    return lhs.tag == value_temp && rhs.tag == value_temp &&
+           lhs.data.value_temp.value == rhs.data.value_temp.value;
+}
+
+static char const *const operator_strs[] = {
+    [INST_ADD] = "+", [INST_SUB] = "-", [INST_MUL] = "*", [INST_DIV] = "/"};
+
+// Returns the value of the constant binary instruction, it is evaluated like
+// the interpreter does at runtime
+static ir_value fold_constants(folder *NONNULL f, ir_instruction inst) {
+    if (inst.kind == INST_RET) {
+        return (ir_value){0};
+    }
+    i64  lhs      = inst.lhs.data.value_constant.value;
+    i64  rhs      = inst.rhs.data.value_constant.value;
+    i64  result   = 0;
+    bool overflow = false;
+    // The traps are errors, the division would always trap at runtime
+    switch (ir_eval_binary(inst.kind, lhs, rhs, &result, &overflow)) {
+        case IR_TRAP_NONE:
+            break;
+        case IR_TRAP_DIVISION_BY_ZERO:
+            report(f, true, inst.pos, "division by zero");
+            return inst.lhs;
+        case IR_TRAP_DIVISION_OVERFLOW:
+            report(f, true, inst.pos, "division of %ld by -1 overflows", lhs);
+            return inst.lhs;
+    }
+    if (overflow) {
+        report(f, false, inst.pos,
+               "integer overflow in %ld %s %ld, it wraps around to %ld", lhs,
+               operator_strs[inst.kind], rhs, result);
+    }
+    return IR_VALUE(value_constant, result);
+}
+
+// Returns the value the instruction simplifies to, or value_none if it has to
+// be kept.
+static ir_value simplify(folder *NONNULL f, ir_instruction inst) {
+    if (inst.lhs.tag == value_constant && inst.rhs.tag == value_constant) {
+        return fold_constants(f, inst);
+    }
+    switch (inst.kind) {
+        case INST_ADD:
+            if (is_constant(inst.lhs, 0)) {
+                return inst.rhs;
+            }
+            if (is_constant(inst.rhs, 0)) {
+                return inst.lhs;
+            }
+            break;
+        case INST_SUB:
+            if (is_constant(inst.rhs, 0)) {
+                return inst.lhs;
+            }
+            if (is_same_temp(inst.lhs, inst.rhs)) {
+                return IR_VALUE(value_constant, 0);
+            }
+            break;
+        case INST_MUL:
+            if (is_constant(inst.lhs, 0) || is_constant(inst.rhs, 0)) {
+                return IR_VALUE(value_constant, 0);
+            }
+            if (is_constant(inst.lhs, 1)) {
+                return inst.rhs;
+            }
+            if (is_constant(inst.rhs, 1)) {
+                return inst.lhs;
+            }
+            break;
+        case INST_DIV:
+            if (is_constant(inst.rhs, 0)) {
+                report(f, true, inst.pos, "division by zero");
+            }
+            if (is_constant(inst.rhs, 1)) {
+                return inst.lhs;
+            }
+            break;
+        case INST_RET:
+            break;
+    }
+    return (ir_value){0};
+}
+
+// Renumbers the remaining vregs, so that they stay dense
+static void renumber(ir_value *NONNULL value, ir_vreg *NONNULL new_vregs) {
+    if (value->tag == value_temp) {
+        value->data.value_temp.value = new_vregs[value->data.value_temp.value];
+    }
+}
+
+static void fold_function(arena *NONNULL a, folder *NONNULL f,
+                          ir_function *NONNULL func) {
+    f->replacements = arena_alloc(a, sizeof(ir_value) * (func->vreg_count + 1));
+    ir_vreg *new_vregs =
+        arena_alloc(a, sizeof(ir_vreg) * (func->vreg_count + 1));
+    for (u32 i = 0; i < func->vreg_count; i++) {
+        f->replacements[i] = (ir_value){0};
+    }
+
+    // The functions are straight line code, every vreg is defined before its
+    // uses, so a single forward pass sees all replacements.
+    size_t kept       = 0;
+    u32    vreg_count = 0;
+    for (size_t i = 0; i < func->instructions.len; i++) {
+        ir_instruction inst = func->instructions.data[i];
+        inst.lhs            = resolve(f, inst.lhs);
+        inst.rhs            = resolve(f, inst.rhs);
+        if (inst.kind != INST_RET) {
+            ir_value replacement = simplify(f, inst);
+            if (replacement.tag != value_none) {
+                f->replacements[inst.dst.data.value_temp.value] = replacement;
+                continue;
+            }
+            new_vregs[inst.dst.data.value_temp.value] = vreg_count++;
+            renumber(&inst.dst, new_vregs);
+        }
+        renumber(&inst.lhs, new_vregs);
+        renumber(&inst.rhs, new_vregs);
+        func->instructions.data[kept++] = inst;
+    }
+    func->instructions.len = kept;
+    func->vreg_count       = vreg_count;
+}
+
+bool ir_fold_program(arena *NONNULL a, ir_program *NONNULL prog) {
+    return ir_fold_program_ex(a, prog, NULL, NULL);
+}
+
+bool ir_fold_program_ex(arena *NONNULL a, ir_program *NONNULL prog,
+                        fold_report_callback NULLABLE rc,
+                        void *NULLABLE                callback_data) {
+    folder f = {.lines = prog->lines, .rc = rc, .callback_data = callback_data};
+    fold_function(a, &f, prog->main_function);
+    return !f.failed;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdarg.h>
+#include "ir.h"
+#include "lexer.h"
+
+// Folds instructions with constant operands and simplifies the algebraic
+// identities x + 0, x - 0, x - x, x * 1, x * 0 and x / 1 in place. Constant
+// arithmetic wraps around like i64 at runtime, with a warning. Returns false
+// after printing the errors, if a division is known to trap.
+bool ir_fold_program(arena *NONNULL a, ir_program *NONNULL prog);
+
+// Receives the errors and warnings of the folder instead of stdout
+typedef void (*fold_report_callback)(void *NULLABLE data, bool error, loc loc,
+                                     char const *NONNULL fmt, va_list arg);
+bool ir_fold_program_ex(arena *NONNULL a, ir_program *NONNULL prog,
+                        fold_report_callback NULLABLE rc,
+                        void *NULLABLE                callback_data);
@@ -0,0 +1,81 @@
+#include "intern.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "da.h"
+#include "rbcc.h"
+
+// FNV-1a
+static u32 hash_bytes(u8 const *NULLABLE data, size_t len) {
+    u32 hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void grow_table(interner *NONNULL in) {
+    size_t          cap   = in->table_cap == 0 ? 64 : in->table_cap * 2;
+    interner_entry *table = xmalloc(sizeof(interner_entry) * cap);
+    memset(table, 0, sizeof(interner_entry) * cap);
+
+    for (size_t i = 0; i < in->table_cap; i++) {
+        interner_entry entry = in->table[i];
+        if (entry.id == 0) {
+            continue;
+        }
+        size_t slot = entry.hash & (cap - 1);
+        while (table[slot].id != 0) {
+            slot = (slot + 1) & (cap - 1);
+        }
+        table[slot] = entry;
+    }
+
+    free(in->table);
+    in->table     = table;
+    in->table_cap = cap;
+}
+
+name_id intern(interner *NONNULL in, str_slice s) {
+    // Keep the load factor below 1/2
+    if ((in->strings.count + 1) * 2 > in->table_cap) {
+        grow_table(in);
+    }
+
+    u32    hash = hash_bytes(s.data, s.len);
+    size_t slot = hash & (in->table_cap - 1);
+    while (in->table[slot].id != 0) {
+        interner_entry entry = in->table[slot];
+        if (entry.hash == hash) {
+            str existing = in->strings.items[entry.id - 1];
+            if (existing.len == s.len &&
+                (s.len == 0 || memcmp(existing.data, s.data, s.len) == 0)) {
+                return entry.id - 1;
+            }
+        }
+        slot = (slot + 1) & (in->table_cap - 1);
+    }
+
+    name_id id = in->strings.count;
+    da_append(&in->strings, arena_slice_clone(&in->arena, s));
+    in->table[slot] = (interner_entry){.hash = hash, .id = id + 1};
+    return id;
+}
+
+name_id intern_str(interner *NONNULL in, str s) {
+    return intern(in, (str_slice){.data = s.data, .len = s.len});
+}
+
+str interned_str(interner const *NONNULL in, name_id id) {
+    assert(id < in->strings.count);
+    return in->strings.items[id];
+}
+
+void interner_free(interner *NONNULL in) {
+    da_free(&in->strings);
+    free(in->table);
+    arena_free(&in->arena);
+    *in = (interner){0};
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include "rbcc.h"
+
+// String interning
+// Every distinct string gets a id, so names can be compared by comparing
+// their ids. The interned strings are stored once, they end with a '\0' and
+// stay valid (and at the same address) until the interner is freed.
+
+typedef u32 name_id;
+
+typedef struct interner_strings {
+    str *NULLABLE items;
+    size_t        count;
+    size_t        capacity;
+} interner_strings;
+
+typedef struct interner_entry {
+    u32 hash;
+    u32 id; // id + 1, 0 marks a empty entry
+} interner_entry;
+
+// A zero initialized interner is empty and ready to use
+typedef struct interner {
+    interner_strings               strings; // indexed by name_id
+    interner_entry *NULLABLE       table;   // open addressing, linear probing
+    size_t                         table_cap;
+    arena                          arena;
+} interner;
+
+name_id intern(interner *NONNULL in, str_slice s);
+name_id intern_str(interner *NONNULL in, str s);
+str     interned_str(interner const *NONNULL in, name_id id);
+void    interner_free(interner *NONNULL in);
@@ -0,0 +1,159 @@
+#include "interpret_ir.h"
+#include <stdlib.h>
+#include "ir.h"
+#include "rbcc.h"
+
+// The instructions are translated into a compact form first, where every
+// operand is a index into the register file. The constants are stored in the
+// register file behind the vregs, so the handlers do not have to check the
+// kind of the operands. With GNU C the handlers are dispatched with computed
+// gotos, the address of the next handler is stored in the instruction.
+#if defined(__GNUC__)
+#define COMPUTED_GOTO 1
+#else
+#define COMPUTED_GOTO 0
+#endif
+
+typedef struct interp_inst {
+#if COMPUTED_GOTO
+    void const *NONNULL handler;
+#endif
+    enum ir_instruction_kind kind;
+    u32                      dst, lhs, rhs;
+    u32                      pos;
+} interp_inst;
+
+char const *NONNULL ir_trap_str(ir_trap trap) {
+    switch (trap) {
+        case IR_TRAP_NONE:
+            return "no trap";
+        case IR_TRAP_DIVISION_BY_ZERO:
+            return "division by zero";
+        case IR_TRAP_DIVISION_OVERFLOW:
+            return "division of -9223372036854775808 by -1 overflows";
+    }
+    return "unknown trap";
+}
+
+static u32 constant_count(ir_value value) {
+    return value.tag == value_temp ? 0 : 1;
+}
+
+// Returns the register of the operand, constants and missing operands get a
+// new register after the vregs
+static u32 operand(i64 *NONNULL regs, u32 *NONNULL next_constant,
+                   ir_value value) {
+    switch (value.tag) {
+        case value_temp:
+            return value.data.value_temp.value;
+        case value_constant:
+            regs[*next_constant] = value.data.value_constant.value;
+            return (*next_constant)++;
+        case value_none:
+            break;
+    }
+    regs[*next_constant] = 0;
+    return (*next_constant)++;
+}
+
+#if COMPUTED_GOTO
+// Taking the address of a label is a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define OP(kind)   op_##kind:
+#define DISPATCH() goto *ip->handler
+#else
+#define OP(kind)   case kind:
+#define DISPATCH() goto dispatch
+#endif
+
+// The handler of a binary instruction, the kind is a constant, so
+// ir_eval_binary is specialized for it
+#define BINARY_OP(kind)                                               \
+    OP(kind) {                                                        \
+        bool overflow;                                                \
+        trap = ir_eval_binary(kind, regs[ip->lhs], regs[ip->rhs],     \
+                              &regs[ip->dst], &overflow);             \
+        if (trap != IR_TRAP_NONE) {                                   \
+            *trap_pos = ip->pos;                                      \
+            goto done;                                                \
+        }                                                             \
+        ip++;                                                         \
+        DISPATCH();                                                   \
+    }
+
+ir_trap ir_interpret_function(ir_function const *NONNULL func,
+                              i64 *NONNULL result, u32 *NONNULL trap_pos) {
+    ir_instructions insts     = func->instructions;
+    // The extra register is the 0 the code returns, if it does not end with
+    // INST_RET
+    size_t          reg_count = func->vreg_count + 1;
+    for (size_t i = 0; i < insts.len; i++) {
+        reg_count += constant_count(insts.data[i].lhs) +
+                     constant_count(insts.data[i].rhs);
+    }
+    i64         *regs          = xmalloc(sizeof(i64) * reg_count);
+    interp_inst *code          = xmalloc(sizeof(interp_inst) * (insts.len + 1));
+    u32          next_constant = func->vreg_count;
+
+#if COMPUTED_GOTO
+    static void const *const handlers[] = {
+        [INST_RET] = &&op_INST_RET, [INST_ADD] = &&op_INST_ADD,
+        [INST_SUB] = &&op_INST_SUB, [INST_MUL] = &&op_INST_MUL,
+        [INST_DIV] = &&op_INST_DIV,
+    };
+#endif
+    for (size_t i = 0; i < insts.len; i++) {
+        ir_instruction inst = insts.data[i];
+        code[i]             = (interp_inst){
+                        .kind = inst.kind,
+                        .lhs  = operand(regs, &next_constant, inst.lhs),
+                        .rhs  = operand(regs, &next_constant, inst.rhs),
+                        .dst  = inst.dst.tag == value_temp
+                                    ? inst.dst.data.value_temp.value
+                                    : 0,
+                        .pos  = inst.pos,
+        };
+    }
+    code[insts.len] = (interp_inst){
+        .kind = INST_RET,
+        .lhs  = operand(regs, &next_constant, (ir_value){0}),
+    };
+#if COMPUTED_GOTO
+    for (size_t i = 0; i <= insts.len; i++) {
+        code[i].handler = handlers[code[i].kind];
+    }
+#endif
+
+    ir_trap            trap = IR_TRAP_NONE;
+    interp_inst const *ip   = code;
+#if COMPUTED_GOTO
+    DISPATCH();
+#else
+dispatch:
+    switch (ip->kind) {
+#endif
+    BINARY_OP(INST_ADD)
+    BINARY_OP(INST_SUB)
+    BINARY_OP(INST_MUL)
+    BINARY_OP(INST_DIV)
+    OP(INST_RET) {
+        *result = regs[ip->lhs];
+        goto done;
+    }
+#if !COMPUTED_GOTO
+    }
+#endif
+
+done:
+    free(regs);
+    free(code);
+    return trap;
+}
+
+#undef BINARY_OP
+#undef OP
+#undef DISPATCH
+#if COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ir.h"
+#include "rbcc.h"
+
+// The semantics of the ir at runtime, for running programs without generating
+// code and for evaluating them at compile time.
+
+typedef enum ir_trap {
+    IR_TRAP_NONE,
+    IR_TRAP_DIVISION_BY_ZERO,
+    IR_TRAP_DIVISION_OVERFLOW, // INT64_MIN / -1
+} ir_trap;
+
+char const *NONNULL ir_trap_str(ir_trap trap);
+
+// Evaluates the binary instruction like the generated machine code does, the
+// arithmetic wraps around and overflow is set if it did. Returns the trap of
+// the division instead of a result.
+static inline ir_trap ir_eval_binary(enum ir_instruction_kind kind, i64 lhs,
+                                     i64 rhs, i64 *NONNULL result,
+                                     bool *NONNULL overflow) {
+    switch (kind) {
+        case INST_ADD:
+            *overflow = __builtin_add_overflow(lhs, rhs, result);
+            return IR_TRAP_NONE;
+        case INST_SUB:
+            *overflow = __builtin_sub_overflow(lhs, rhs, result);
+            return IR_TRAP_NONE;
+        case INST_MUL:
+            *overflow = __builtin_mul_overflow(lhs, rhs, result);
+            return IR_TRAP_NONE;
+        case INST_DIV:
+            *overflow = false;
+            if (rhs == 0) {
+                return IR_TRAP_DIVISION_BY_ZERO;
+            }
+            if (lhs == INT64_MIN && rhs == -1) {
+                return IR_TRAP_DIVISION_OVERFLOW;
+            }
+            *result = lhs / rhs;
+            return IR_TRAP_NONE;
+        case INST_RET:
+            break;
+    }
+    *overflow = false;
+    *result   = 0;
+    return IR_TRAP_NONE;
+}
+
+// Runs the function on a register file indexed by its vregs and stores what
+// it returned in result. If a instruction traps, the trap is returned and
+// trap_pos is set to the position of the instruction.
+ir_trap ir_interpret_function(ir_function const *NONNULL func,
+                              i64 *NONNULL result, u32 *NONNULL trap_pos);
@@ -1,8 +1,15 @@
 #pragma once
 
 #include <stddef.h>
+#include "intern.h"
+#include "lexer.h"
 #include "rbcc.h"
 
+// The ir is allocated in a arena, the ir_instructions_buffer used while
+// building it are on the heap. Instructions are stored by value in flat
+// arrays and their operands are stored inline, temporaries are virtual
+// registers numbered per function.
+
 // Typedefs
 typedef struct ir_program             ir_program;
 typedef struct ir_function            ir_function;
@@ -11,15 +18,17 @@ typedef struct ir_instruction         ir_instruction;
 typedef struct ir_instructions        ir_instructions;
 typedef struct ir_instructions_buffer ir_instructions_buffer;
 
+// A virtual register, the index of a temporary in its function
+typedef u32                           ir_vreg;
+
 struct ir_instructions {
     ir_instruction *NULLABLE data;
     size_t                   len;
 };
 
-// Frees the buffer
-ir_instructions ir_instructions_new(ir_instructions_buffer buffer);
-void            ir_instructions_free(ir_instructions vec);
-void            ir_instructions_free_all(ir_instructions vec);
+// Copies the instructions into the arena and frees the buffer
+ir_instructions ir_instructions_new(arena *NONNULL        a,
+                                    ir_instructions_buffer buffer);
 
 struct ir_instructions_buffer {
     ir_instruction *NULLABLE data;
@@ -30,46 +39,46 @@ struct ir_instructions_buffer {
 void ir_instructions_buffer_push(ir_instructions_buffer *NONNULL buffer,
                                  ir_instruction                  inst);
 
-// Appends and frees a ir_instructions list
-void ir_instructions_buffer_append(ir_instructions_buffer *NONNULL buffer,
-                                   ir_instructions                 list);
 ir_instructions_buffer ir_instructions_buffer_new(size_t initial_cap);
 void ir_instructions_buffer_free(ir_instructions_buffer buffer);
-void ir_instructions_buffer_free_all(ir_instructions_buffer buffer);
 
 struct ir_program {
     ir_function *NONNULL main_function;
+    // The function names are interned here
+    interner *NONNULL    names;
+    // The lines of the source, for the locations of diagnostics
+    line_table *NONNULL  lines;
 };
 
 void ir_program_print(ir_program *NONNULL program);
-void ir_program_free(ir_program *NONNULL program);
 
 struct ir_function {
-    str             name;
+    name_id         name;
     ir_instructions instructions;
+    // The vregs of the function are 0..vreg_count-1
+    u32             vreg_count;
 };
 
-void ir_function_print(ir_function *NONNULL function);
-void ir_function_free(ir_function *NONNULL function);
+void ir_function_print(interner const *NONNULL names,
+                       ir_function *NONNULL    function);
 
 struct ir_value {
-    enum ir_value_kind { value_constant, value_temp } tag;
+    // A zero initialized value is value_none
+    enum ir_value_kind { value_none, value_constant, value_temp } tag;
     union {
         struct value_constant {
             i64 value;
         } value_constant;
         struct value_temp {
-            str value;
+            ir_vreg value;
         } value_temp;
     } data;
 };
 
-#define IR_VALUE_NEW(kind, ...) \
-    ir_value_new((ir_value){kind, {.kind = (struct kind){__VA_ARGS__}}})
+#define IR_VALUE(kind, ...) \
+    ((ir_value){kind, {.kind = (struct kind){__VA_ARGS__}}})
 
-void              ir_value_print(ir_value *NONNULL value);
-ir_value *NONNULL ir_value_new(ir_value value);
-void              ir_value_free(ir_value *NONNULL value);
+void ir_value_print(ir_value value);
 
 struct ir_instruction {
     enum ir_instruction_kind {
@@ -79,14 +88,11 @@ struct ir_instruction {
         INST_MUL, // uses lhs, rhs, and dst
         INST_DIV, // uses lhs, rhs, and dst
     } kind;
-    ir_value *NULLABLE lhs, *NULLABLE rhs;
-    ir_value *NULLABLE dst;
+    ir_value lhs, rhs;
+    ir_value dst;
+    u32      pos; // of the expression it was emitted for, for diagnostics
 };
 
 void           ir_instruction_print(ir_instruction *NONNULL inst);
-ir_instruction ir_instruction_new(enum ir_instruction_kind kind,
-                                  ir_value *NULLABLE       lhs,
-                                  ir_value *NULLABLE       rhs,
-                                  ir_value *NULLABLE       dst);
-
-void           ir_instruction_free(ir_instruction inst);
+ir_instruction ir_instruction_new(enum ir_instruction_kind kind, ir_value lhs,
+                                  ir_value rhs, ir_value dst, u32 pos);
@@ -2,12 +2,14 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "da.h"
+#include "lexer_scan.h"
 #include "rbcc.h"
 #include "utf8proc.h"
-#include "uthash.h"
 
 char const *const token_kind_strs[] = {
 #define _X(name) [T##name] = #name,
@@ -27,59 +29,91 @@ char const *token_kind_str(token_kind kind) {
     return token_kind_strs[kind];
 }
 
-// Keywords map
-
-typedef struct keyword {
-    char const    *key;
-    token_kind     value;
-    UT_hash_handle hh;
-} keyword;
-
-static keyword *keywords = NULL;
-
-#define KEYWORD(name, v)                         \
-    do {                                         \
-        keyword *kw  = xmalloc(sizeof(keyword)); \
-        char    *key = xmalloc(sizeof(name));    \
-        memcpy(key, name, sizeof(name));         \
-        kw->key   = key;                         \
-        kw->value = v;                           \
-        HASH_ADD_STR(keywords, key, kw);         \
-    } while (0)
-
-static void init_keywords(void) {
-    if (keywords == NULL) {
-        KEYWORD("fn", TFN);
-    }
-}
-
-static void uninit_keywords(void) {
-    if (keywords != NULL) {
-        keyword *el, *tmp;
-        HASH_ITER(hh, keywords, el, tmp) {
-            HASH_DEL(keywords, el);
-            // We cast the const away
-            free((char *)el->key);
-            free(el);
-        }
+// Keywords
+// The keywords are short ascii words, every check compares the length first
+// and the memcmp of a constant size compiles to a single compare, so no
+// table has to be built at runtime.
+#define KEYWORDS _X("fn", TFN)
+
+static token_kind keyword_kind(str_slice ident) {
+#define _X(name, kind)                                     \
+    if (ident.len == sizeof(name) - 1 &&                   \
+        memcmp(ident.data, name, sizeof(name) - 1) == 0) { \
+        return kind;                                       \
     }
+    KEYWORDS
+#undef _X
+    return TIDENT;
 }
 
-static void default_error_callback(loc loc, char const *fmt, va_list arg) {
+static void default_error_callback(void *NULLABLE data, loc loc,
+                                   char const *fmt, va_list arg) {
+    (void)data;
     va_list arg2;
     va_copy(arg2, arg);
 
     int   buffer_size = vsnprintf(NULL, 0, fmt, arg) + 1;
     char *buffer      = xmalloc(buffer_size);
     vsnprintf(buffer, buffer_size, fmt, arg2);
-    fprintf(stdout, "%s[%d:%d] Lexer Error %s", loc.file.data, loc.line,
+    fprintf(stdout, "%s[%d:%d] Lexer Error %s\n", loc.file.data, loc.line,
             loc.column, buffer);
     free(buffer);
 
     va_end(arg2);
 }
 
-static bool is_letter(utf8proc_uint32_t ch) {
+// Classes of the bytes of the input. Ascii characters are classified with
+// this table, bytes >= 0x80 are part of a multibyte sequence and have to go
+// through utf8proc.
+enum char_class {
+    CC_OTHER     = 0,
+    CC_LETTER    = 1 << 0,
+    CC_DIGIT     = 1 << 1,
+    CC_BLANK     = 1 << 2, // space and tab
+    CC_NEWLINE   = 1 << 3,
+    CC_MULTIBYTE = 1 << 4,
+};
+
+#define O CC_OTHER
+#define L CC_LETTER
+#define D CC_DIGIT
+#define W CC_BLANK
+#define N CC_NEWLINE
+#define M CC_MULTIBYTE
+static u8 const char_classes[256] = {
+    O, O, O, O, O, O, O, O, O, W, N, O, O, O, O, O, // 0x00
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, // 0x10
+    W, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, // 0x20  !"#$%&'()*+,-./
+    D, D, D, D, D, D, D, D, D, D, O, O, O, O, O, O, // 0x30 0-9:;<=>?
+    O, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L, // 0x40 @A-O
+    L, L, L, L, L, L, L, L, L, L, L, O, O, O, O, O, // 0x50 P-Z[\]^_
+    O, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L, // 0x60 `a-o
+    L, L, L, L, L, L, L, L, L, L, L, O, O, O, O, O, // 0x70 p-z{|}~
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, // 0x80
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, // 0x90
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, // 0xa0
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, // 0xb0
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, // 0xc0
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, // 0xd0
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, // 0xe0
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, // 0xf0
+};
+#undef O
+#undef L
+#undef D
+#undef W
+#undef N
+#undef M
+
+static bool is_ascii(utf8proc_int32_t ch) { return ch >= 0 && ch < 0x80; }
+
+static bool is_letter(utf8proc_int32_t ch) {
+    if (is_ascii(ch)) {
+        return char_classes[ch] & CC_LETTER;
+    }
+    if (ch < 0) {
+        return false;
+    }
     const utf8proc_property_t *prop = utf8proc_get_property(ch);
     switch (prop->category) {
         case UTF8PROC_CATEGORY_LT:
@@ -92,116 +126,160 @@ static bool is_letter(utf8proc_uint32_t ch) {
     return false;
 }
 
-// Returns -1 on failure
-static i32 number_value(utf8proc_uint32_t ch) {
-    switch (ch) {
-        case '0':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
-            return ch - '0';
-    }
-    return -1;
+static bool is_number(utf8proc_int32_t ch) {
+    return is_ascii(ch) && char_classes[ch] & CC_DIGIT;
 }
 
-static bool is_number(utf8proc_uint32_t ch) {
-    switch (ch) {
-        case '0':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
-            return true;
-    }
-    return false;
+static bool is_whitespace(utf8proc_int32_t ch) {
+    return is_ascii(ch) && char_classes[ch] & (CC_BLANK | CC_NEWLINE);
 }
 
-loc pos_to_loc(lexer *l, u32 pos) {
-    return (loc){.file   = str_clone(l->file),
-                 .line   = l->line,
-                 .column = pos - l->pos_since_line + 1,
+loc line_table_loc(line_table const *NONNULL lines, u32 pos) {
+    // The last line that starts at or before pos
+    size_t lo = 0, hi = lines->starts.count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (lines->starts.items[mid] <= pos) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return (loc){.file   = lines->file,
+                 .line   = (u32)lo + 1,
+                 .column = pos - lines->starts.items[lo] + 1,
                  .pos    = pos};
 }
 
+void line_table_free(line_table *NONNULL lines) {
+    free(lines->starts.items);
+    lines->starts = (line_starts){0};
+}
+
 void PRINTF_FORMAT(2, 3) error(lexer *l, char const *fmt, ...) {
     va_list arg;
     va_start(arg, fmt);
 
-    loc loc = pos_to_loc(l, l->pos);
+    loc loc = line_table_loc(l->lines, l->pos);
     if (l->ec != NULL) {
-        l->ec(loc, fmt, arg);
+        l->ec(l->callback_data, loc, fmt, arg);
     }
     l->errors += 1;
-    str_free(loc.file);
 
     va_end(arg);
 }
 
-void read_ch(lexer *l) {
-    if (l->read_pos < l->input.len) {
-        l->pos = l->read_pos;
-        if (l->ch == '\n') {
-            l->pos_since_line = l->pos;
-            l->line += 1;
-        }
-        utf8proc_ssize_t read = utf8proc_iterate(l->input.data + l->pos,
-                                                 l->input.len - l->pos, &l->ch);
-        if (read < 0) {
-            switch (read) {
-                case UTF8PROC_ERROR_INVALIDUTF8:
-                    error(l, "invalid utf8 character");
-                    break;
-                case UTF8PROC_ERROR_OVERFLOW:
-                    error(l, "input string is to big");
-                    break;
-                case UTF8PROC_ERROR_NOMEM:
-                    CHECK_ALLOC(NULL);
-                    error(l,
-                          "CRITICAL ERROR: RAN OUT OF MEMORY AND DIDN'T ABORT");
-                    break;
-                case UTF8PROC_ERROR_NOTASSIGNED:
-                default:
-                    error(l, "unknown utf8 error");
-                    break;
-            }
+// Decodes the multibyte character at l->pos
+static void read_multibyte_ch(lexer *l) {
+    utf8proc_ssize_t read = utf8proc_iterate(l->input.data + l->pos,
+                                             l->input.len - l->pos, &l->ch);
+    if (read < 0) {
+        switch (read) {
+            case UTF8PROC_ERROR_INVALIDUTF8:
+                error(l, "invalid utf8 character");
+                break;
+            case UTF8PROC_ERROR_OVERFLOW:
+                error(l, "input string is to big");
+                break;
+            case UTF8PROC_ERROR_NOMEM:
+                CHECK_ALLOC(NULL);
+                error(l, "CRITICAL ERROR: RAN OUT OF MEMORY AND DIDN'T ABORT");
+                break;
+            case UTF8PROC_ERROR_NOTASSIGNED:
+            default:
+                error(l, "unknown utf8 error");
+                break;
         }
+        // Skip the invalid byte, it lexes as a invalid token
+        l->ch = 0xfffd;
+        read  = 1;
+    }
 
-        if (l->ch == 0xfeff && l->pos > 0) {
-            error(l, "illegal bom");
-        }
+    if (l->ch == 0xfeff && l->pos > 0) {
+        error(l, "illegal bom");
+    }
 
-        // Debug
-        /*u8 string[5];*/
-        /*size_t w = utf8proc_encode_char(l->ch, string);*/
-        /*string[w] = 0;*/
-        /*printf("lex: %s\n", string);*/
+    // Debug
+    /*u8 string[5];*/
+    /*size_t w = utf8proc_encode_char(l->ch, string);*/
+    /*string[w] = 0;*/
+    /*printf("lex: %s\n", string);*/
 
-        l->read_pos += read;
+    l->read_pos += read;
+}
+
+static inline void read_ch(lexer *l) {
+    l->pos = l->read_pos;
+    if (l->ch == '\n') {
+        line_starts_add(&l->lines->starts, l->pos);
+    }
+    u8 byte = l->input.data[l->pos];
+    if (char_classes[byte] & CC_MULTIBYTE) {
+        read_multibyte_ch(l);
+    } else if (byte == 0 && l->pos >= l->input.len) {
+        // The zero byte after the input
+        l->ch = -1;
     } else {
-        l->pos = l->input.len;
-        if (l->ch == '\n') {
-            l->pos_since_line = l->pos;
-            l->line += 1;
+        l->ch = byte;
+        l->read_pos += 1;
+    }
+}
+
+static bool in_run(scan_class class, u8 byte) {
+    switch (class) {
+        case SCAN_WHITESPACE:
+            return char_classes[byte] & (CC_BLANK | CC_NEWLINE);
+        case SCAN_IDENT:
+            return char_classes[byte] & (CC_LETTER | CC_DIGIT);
+        case SCAN_DIGITS:
+            return char_classes[byte] & CC_DIGIT;
+        case SCAN_STRING:
+            return byte != '"' && byte != 0 &&
+                   !(char_classes[byte] & CC_MULTIBYTE);
+    }
+    return false;
+}
+
+// Most runs are a few bytes long, they are skipped with the table, only the
+// longer ones go through the vectorized scanners.
+#define SHORT_RUN 8
+
+// Skips the ascii run of the class, that starts at the current character, and
+// continues with the character after it.
+static inline void skip_run(lexer *l, scan_class class) {
+    u8 const *data  = l->input.data;
+    u32       limit = l->pos + SHORT_RUN;
+    u32       end   = l->pos;
+    // The zero byte after the input is in none of the classes, so this stops
+    // at the end
+    while (end < limit && in_run(class, data[end])) {
+        if (data[end] == '\n') {
+            line_starts_add(&l->lines->starts, end + 1);
         }
-        l->ch = -1;
+        end++;
     }
+    if (end == limit) {
+        end = scan_class_run(class, data, end, l->input.len, &l->lines->starts);
+    } else if (end == l->pos) {
+        // The current character is not in the run, like a zero byte inside a
+        // string, it is read like any other
+        read_ch(l);
+        return;
+    }
+
+    l->read_pos = end;
+    l->ch       = 0; // the lines are already added
+    read_ch(l);
 }
 
 static str_slice scan_ident(lexer *l) {
     u32 old_pos = l->pos;
     while (is_letter(l->ch) || is_number(l->ch)) {
-        read_ch(l);
+        if (is_ascii(l->ch)) {
+            skip_run(l, SCAN_IDENT);
+        } else {
+            read_ch(l);
+        }
     }
 
     // dhapd
@@ -224,66 +302,40 @@ static str_slice scan_string(lexer *l) {
     u32 old_pos = l->pos;
     read_ch(l); // skip '"'
     while (l->ch != '"' && l->ch != -1) {
-        read_ch(l);
+        if (is_ascii(l->ch)) {
+            skip_run(l, SCAN_STRING);
+        } else {
+            read_ch(l);
+        }
     }
     read_ch(l); // eat '"'
 
     return (str_slice){.data = l->input.data + old_pos,
                        .len  = l->pos - old_pos};
 }
-typedef struct scan_constant_result {
-    i64       value;
-    str_slice literal;
-} scan_constant_result;
-static scan_constant_result scan_constant(lexer *l) {
-    u32  old_pos = l->pos;
-    bool minus   = false;
+
+static i64 scan_constant(lexer *l) {
+    bool minus = false;
     if (l->ch == '-') {
         minus = true;
         read_ch(l);
     }
-    i64    value = 0;
-    size_t i     = 1;
-
-    // 324
-    // ^
-    // value = 3, i = 10
-    // 324
-    //  ^
-    // value = 23, i = 100
-    // 324
-    //   ^
-    // value = 423, i = 1000
-    //
-    //
-    // 423
-    //
-    // 423 % 100 = 23
-    // (423 - 23) / 100 = 4
-
-    while (is_number(l->ch)) {
-        value += number_value(l->ch) * i;
-        i *= 10;
-        read_ch(l);
+    i64 value  = 0;
+    u32 digits = l->pos;
+    if (is_number(l->ch)) {
+        skip_run(l, SCAN_DIGITS);
     }
-
-    i64 reverse = 0;
-    while (value > 0) {
-        reverse = reverse * 10 + value % 10;
-        value   = value / 10;
+    for (; digits < l->pos; digits++) {
+        // Wraps around like the i64 arithmetic at runtime
+        value = (i64)((u64)value * 10 + (u64)(l->input.data[digits] - '0'));
     }
 
-    value = minus ? -reverse : reverse;
-    return (scan_constant_result){
-        .value   = value,
-        .literal = (str_slice){.data = l->input.data + old_pos,
-                               .len  = l->pos - old_pos}
-    };
+    return minus ? -value : value;
 }
 
 static void skip_whitespace(lexer *l) {
-    while (l->ch == '\n' || l->ch == '\t' || l->ch == ' ') {
-        read_ch(l);
+    if (is_whitespace(l->ch)) {
+        skip_run(l, SCAN_WHITESPACE);
     }
 }
 
@@ -291,26 +343,22 @@ token lexer_scan_token(lexer *l) {
     skip_whitespace(l);
 
     token_kind kind    = TINVALID;
-    loc        loc     = pos_to_loc(l, l->pos);
-    str_slice  literal = {.data = l->input.data + l->pos, .len = 1};
-    token_data data    = {0};
+    u32        start   = l->pos;
+    u32        payload = 0;
 
     if (is_letter(l->ch)) {
-        kind    = TIDENT;
-        literal = scan_ident(l);
-        keyword *out;
-        HASH_FIND(hh, keywords, literal.data, literal.len, out);
-        if (out != NULL) {
-            kind = out->value;
+        str_slice literal = scan_ident(l);
+        kind              = keyword_kind(literal);
+        if (kind == TIDENT) {
+            payload = intern(l->names, literal);
         }
     } else if (l->ch == '"') {
-        kind    = TSTRING;
-        literal = scan_string(l);
+        kind = TSTRING;
+        scan_string(l);
     } else if (is_number(l->ch)) {
-        scan_constant_result result = scan_constant(l);
-        literal                     = result.literal;
-        data                        = (token_data){.constant = result.value};
-        kind                        = TCONSTANT;
+        kind    = TCONSTANT;
+        payload = (u32)l->constants.count;
+        da_append(&l->constants, scan_constant(l));
     } else {
         switch (l->ch) {
             case -1:
@@ -345,31 +393,69 @@ token lexer_scan_token(lexer *l) {
     }
 
     return (token){
-        .literal = literal,
         .kind    = kind,
-        .data    = data,
-        .loc     = loc,
+        .pos     = start,
+        .len     = l->pos - start,
+        .payload = payload,
     };
 }
 
-lexer *lexer_new(str input) {
-    return lexer_new_ex(input, default_error_callback);
+tokens lexer_tokenize_all(lexer *NONNULL l) {
+    // Roughly one token every four bytes, grown if the guess is too small
+    tokens toks   = {0};
+    toks.capacity = (l->input.len - l->pos) / 4 + 16;
+    toks.items    = xmalloc(sizeof(token) * toks.capacity);
+    while (true) {
+        token tok = lexer_scan_token(l);
+        da_append(&toks, tok);
+        if (tok.kind == TEOF) {
+            break;
+        }
+    }
+    return toks;
 }
 
-lexer *lexer_new_ex(str input, lexer_error_callback ec) {
-    init_keywords();
+str_slice token_literal(lexer const *NONNULL l, token tok) {
+    return (str_slice){.data = l->input.data + tok.pos, .len = tok.len};
+}
+
+i64 token_constant(lexer const *NONNULL l, token tok) {
+    return l->constants.items[tok.payload];
+}
+
+lexer *lexer_new(interner *NONNULL names, line_table *NONNULL lines, str file,
+                 str input) {
+    return lexer_new_ex(names, lines, file, input, default_error_callback,
+                        NULL);
+}
+
+lexer *lexer_new_ex(interner *NONNULL names, line_table *NONNULL lines,
+                    str file, str input, lexer_error_callback ec,
+                    void *NULLABLE callback_data) {
     lexer *l = xmalloc(sizeof(struct lexer));
 
-    *l       = (struct lexer){
-              .pos            = 0,
-              .read_pos       = 0,
-              .pos_since_line = 0,
-              .line           = 1,
-              .input          = input,
-              .errors         = 0,
-              .ec             = ec,
+    line_table_free(lines);
+    lines->file = interned_str(names, intern_str(names, file));
+    line_starts_add(&lines->starts, 0);
+
+    *l = (struct lexer){
+        .pos           = 0,
+        .read_pos      = 0,
+        .input         = input,
+        .errors        = 0,
+        .ec            = ec,
+        .callback_data = callback_data,
+        .names         = names,
+        .lines         = lines,
     };
 
+    // Positions are u32, they would wrap around in bigger inputs
+    if (input.len > UINT32_MAX) {
+        l->input = S("");
+        error(l, "the file is %zu bytes, files can be at most %u bytes",
+              input.len, UINT32_MAX);
+    }
+
     read_ch(l);
     if (l->ch == 0xfeff) {
         read_ch(l);
@@ -379,20 +465,6 @@ lexer *lexer_new_ex(str input, lexer_error_callback ec) {
 }
 
 void lexer_free(lexer *l) {
+    free(l->constants.items);
     free(l);
-    uninit_keywords();
-}
-
-token lexer_token_clone(token tok) {
-    return (token){
-        .data    = tok.data,
-        .loc     = {.file   = str_clone(tok.loc.file),
-                    .column = tok.loc.column,
-                    .line   = tok.loc.line,
-                    .pos    = tok.loc.pos},
-        .kind    = tok.kind,
-        .literal = tok.literal,
-    };
 }
-
-void lexer_token_free(token tok) { str_free(tok.loc.file); }
@@ -3,6 +3,8 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
+#include "intern.h"
+#include "lexer_scan.h"
 #include "rbcc.h"
 #include "utf8proc.h"
 
@@ -37,48 +39,81 @@ extern char const *const token_kind_strs[];
 
 char const              *token_kind_str(token_kind kind);
 
+// A location expanded for diagnostics, tokens only store the byte offset
 typedef struct loc {
     u32 pos;
     u32 line;
     u32 column;
-    str file;
+    str file; // interned, not owned
 } loc;
 
-typedef union token_data {
-    i64 constant;
-} token_data;
+// Maps the byte offsets of a file to lines and columns, the lexer appends
+// the start of every line it passes, so the lines and columns are only
+// computed when a diagnostic is printed.
+typedef struct line_table {
+    str         file; // interned
+    line_starts starts;
+} line_table;
+
+loc  line_table_loc(line_table const *NONNULL lines, u32 pos);
+void line_table_free(line_table *NONNULL lines);
 
 typedef struct token {
     token_kind kind;
-    loc        loc;
-    str_slice  literal;
-    token_data data;
+    u32        pos; // byte offset into the input
+    u32        len; // in bytes
+    // TIDENT: the name_id
+    // TCONSTANT: the index into lexer.constants
+    u32        payload;
 } token;
 
+static_assert(sizeof(token) == 16, "tokens should stay 16 bytes");
+
 typedef struct tokens {
-    token *data;
-    size_t len;
+    token *NULLABLE items;
+    size_t          count;
+    size_t          capacity;
 } tokens;
 
-typedef void (*lexer_error_callback)(loc loc, char const *fmt, va_list arg);
+typedef struct constants {
+    i64 *NULLABLE items;
+    size_t        count;
+    size_t        capacity;
+} constants;
+
+// data is the callback_data the lexer was created with
+typedef void (*lexer_error_callback)(void *NULLABLE data, loc loc,
+                                     char const *fmt, va_list arg);
 typedef struct lexer {
-    u32                  pos;
-    u32                  read_pos;
-    u32                  pos_since_line;
-    u32                  line;
+    u32                   pos;
+    u32                   read_pos;
+
+    utf8proc_int32_t      ch;
+    str                   input;
 
-    utf8proc_int32_t     ch;
-    str                  input;
-    str                  file;
+    // The values of the TCONSTANT tokens
+    constants             constants;
 
-    u32                  errors;
-    lexer_error_callback ec;
+    u32                   errors;
+    lexer_error_callback  ec;
+    void *NULLABLE        callback_data;
+    // The identifiers and the file name are interned here
+    interner *NONNULL     names;
+    line_table *NONNULL   lines;
 } lexer;
 
-token  lexer_scan_token(lexer *l);
-void   lexer_token_free(token tok);
-token  lexer_token_clone(token tok);
+token     lexer_scan_token(lexer *l);
+// Scans the rest of the input into one array, the last token is TEOF.
+tokens    lexer_tokenize_all(lexer *NONNULL l);
+str_slice token_literal(lexer const *NONNULL l, token tok);
+i64       token_constant(lexer const *NONNULL l, token tok);
 
-lexer *lexer_new(str input);
-lexer *lexer_new_ex(str input, lexer_error_callback ec);
+// The input has to be followed by a zero byte, like the contents of a
+// source_file. The line table is reset and filled while lexing, it can
+// outlive the lexer.
+lexer *lexer_new(interner *NONNULL names, line_table *NONNULL lines, str file,
+                 str input);
+lexer *lexer_new_ex(interner *NONNULL names, line_table *NONNULL lines,
+                    str file, str input, lexer_error_callback ec,
+                    void *NULLABLE callback_data);
 void   lexer_free(lexer *l);
@@ -0,0 +1,216 @@
+#include "lexer_scan.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include "da.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#else
+#define SCAN_X86 0
+#endif
+
+// Out of line, the growth code would otherwise be inlined into the hot loops
+// of the lexer
+void line_starts_add(line_starts *NONNULL lines, u32 start) {
+    da_append(lines, start);
+}
+
+static bool in_class(scan_class class, u8 byte) {
+    switch (class) {
+        case SCAN_WHITESPACE:
+            return byte == ' ' || byte == '\t' || byte == '\n';
+        case SCAN_IDENT:
+            return (u8)((byte | 0x20) - 'a') < 26 || (u8)(byte - '0') < 10;
+        case SCAN_DIGITS:
+            return (u8)(byte - '0') < 10;
+        case SCAN_STRING:
+            return byte != '"' && byte < 0x80;
+    }
+    return false;
+}
+
+static bool has_newlines(scan_class class) {
+    return class == SCAN_WHITESPACE || class == SCAN_STRING;
+}
+
+// Continues the run at i a byte at a time, used for the tail of the input
+// that is shorter than a vector.
+static u32 scan_scalar(scan_class class, u8 const *NONNULL data, u32 i, u32 len,
+                       line_starts *NONNULL lines) {
+    for (; i < len && in_class(class, data[i]); i++) {
+        if (data[i] == '\n') {
+            line_starts_add(lines, i + 1);
+        }
+    }
+    return i;
+}
+
+#if SCAN_X86
+
+// Appends the lines that start after the newlines in the first count bytes
+// of the block at i
+static void add_lines(line_starts *NONNULL lines, u32 newlines, u32 i,
+                      u32 count) {
+    newlines &= (u32)((1ull << count) - 1);
+    while (newlines != 0) {
+        line_starts_add(lines, i + (u32)__builtin_ctz(newlines) + 1);
+        newlines &= newlines - 1;
+    }
+}
+
+// The bytes in [lo, lo + count), there are no unsigned byte compares, so the
+// range is moved to the bottom of the signed range.
+static inline __m128i sse2_in_range(__m128i v, u8 lo, u8 count) {
+    __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - lo)));
+    return _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(0x80 + count)));
+}
+
+// A bit for every byte of the block, that is in the class
+static inline u32 sse2_class_bits(scan_class class, __m128i v) {
+    __m128i in;
+    switch (class) {
+        case SCAN_WHITESPACE:
+            in = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+            return (u32)_mm_movemask_epi8(in);
+        case SCAN_IDENT:
+            in = _mm_or_si128(
+                sse2_in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 26),
+                sse2_in_range(v, '0', 10));
+            return (u32)_mm_movemask_epi8(in);
+        case SCAN_DIGITS:
+            return (u32)_mm_movemask_epi8(sse2_in_range(v, '0', 10));
+        case SCAN_STRING: {
+            u32 stop = (u32)_mm_movemask_epi8(
+                           _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) |
+                       (u32)_mm_movemask_epi8(v);
+            return ~stop & 0xffff;
+        }
+    }
+    return 0;
+}
+
+static inline u32 scan_sse2(scan_class class, u8 const *NONNULL data, u32 i,
+                            u32 len, line_starts *NONNULL lines) {
+    while (len - i >= 16) {
+        __m128i v     = _mm_loadu_si128((__m128i const *)(data + i));
+        u32     stop  = ~sse2_class_bits(class, v) & 0xffff;
+        u32     count = stop != 0 ? (u32)__builtin_ctz(stop) : 16;
+        if (has_newlines(class)) {
+            u32 newlines = (u32)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+            add_lines(lines, newlines, i, count);
+        }
+        i += count;
+        if (stop != 0) {
+            return i;
+        }
+    }
+    return scan_scalar(class, data, i, len, lines);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i avx2_in_range(__m256i v, u8 lo, u8 count) {
+    __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - lo)));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + count)), shifted);
+}
+
+static inline AVX2 u32 avx2_class_bits(scan_class class, __m256i v) {
+    __m256i in;
+    switch (class) {
+        case SCAN_WHITESPACE:
+            in = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+            return (u32)_mm256_movemask_epi8(in);
+        case SCAN_IDENT:
+            in = _mm256_or_si256(
+                avx2_in_range(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a',
+                              26),
+                avx2_in_range(v, '0', 10));
+            return (u32)_mm256_movemask_epi8(in);
+        case SCAN_DIGITS:
+            return (u32)_mm256_movemask_epi8(avx2_in_range(v, '0', 10));
+        case SCAN_STRING: {
+            u32 stop = (u32)_mm256_movemask_epi8(
+                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) |
+                       (u32)_mm256_movemask_epi8(v);
+            return ~stop;
+        }
+    }
+    return 0;
+}
+
+static inline AVX2 u32 scan_avx2(scan_class class, u8 const *NONNULL data,
+                                 u32 i, u32 len, line_starts *NONNULL lines) {
+    while (len - i >= 32) {
+        __m256i v     = _mm256_loadu_si256((__m256i const *)(data + i));
+        u32     stop  = ~avx2_class_bits(class, v);
+        u32     count = stop != 0 ? (u32)__builtin_ctz(stop) : 32;
+        if (has_newlines(class)) {
+            u32 newlines = (u32)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+            add_lines(lines, newlines, i, count);
+        }
+        i += count;
+        if (stop != 0) {
+            return i;
+        }
+    }
+    // The tail still gets a 16 byte block
+    return scan_sse2(class, data, i, len, lines);
+}
+
+// The class is passed as a constant, so that the compiler can specialize the
+// loops for every class.
+#define SCAN_DISPATCH(scan)                                        \
+    switch (class) {                                               \
+        case SCAN_WHITESPACE:                                      \
+            return scan(SCAN_WHITESPACE, data, start, len, lines); \
+        case SCAN_IDENT:                                           \
+            return scan(SCAN_IDENT, data, start, len, lines);      \
+        case SCAN_DIGITS:                                          \
+            return scan(SCAN_DIGITS, data, start, len, lines);     \
+        case SCAN_STRING:                                          \
+            return scan(SCAN_STRING, data, start, len, lines);     \
+    }                                                              \
+    return start
+
+static AVX2 u32 scan_avx2_dispatch(scan_class class, u8 const *NONNULL data,
+                                   u32 start, u32 len,
+                                   line_starts *NONNULL lines) {
+    SCAN_DISPATCH(scan_avx2);
+}
+
+static u32 scan_sse2_dispatch(scan_class class, u8 const *NONNULL data,
+                              u32 start, u32 len, line_starts *NONNULL lines) {
+    SCAN_DISPATCH(scan_sse2);
+}
+
+u32 scan_class_run(scan_class class, u8 const *NONNULL data, u32 start,
+                   u32 len, line_starts *NONNULL lines) {
+    if (__builtin_cpu_supports("avx2")) {
+        return scan_avx2_dispatch(class, data, start, len, lines);
+    }
+    return scan_sse2_dispatch(class, data, start, len, lines);
+}
+
+char const *scan_isa(void) {
+    return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+}
+
+#else
+
+u32 scan_class_run(scan_class class, u8 const *NONNULL data, u32 start,
+                   u32 len, line_starts *NONNULL lines) {
+    return scan_scalar(class, data, start, len, lines);
+}
+
+char const *scan_isa(void) { return "scalar"; }
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "rbcc.h"
+
+// Vectorized scanners for the runs of ascii characters the lexer skips over.
+// They use AVX2 if the cpu supports it and SSE2 otherwise on x86_64, and a
+// byte at a time loop on other architectures.
+
+typedef enum scan_class {
+    SCAN_WHITESPACE, // space, tab and newline
+    SCAN_IDENT,      // ascii letters and digits
+    SCAN_DIGITS,
+    SCAN_STRING, // everything except '"' and non ascii bytes
+} scan_class;
+
+// The offsets of the first bytes of the lines, in ascending order
+typedef struct line_starts {
+    u32 *NULLABLE items;
+    size_t        count;
+    size_t        capacity;
+} line_starts;
+
+void line_starts_add(line_starts *NONNULL lines, u32 start);
+
+// Returns the index of the first byte after the run of bytes of the class,
+// that starts at start. The lines that start in the run are appended to
+// lines.
+u32 scan_class_run(scan_class class, u8 const *NONNULL data, u32 start,
+                   u32 len, line_starts *NONNULL lines);
+
+// The name of the instruction set the scanners use on this cpu
+char const *NONNULL scan_isa(void);
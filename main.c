@@ -1,27 +1,39 @@
 #if defined (__linux__) || defined (__unix__)
 #define _POSIX_C_SOURCE 200809L
 #endif
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "ast.h"
+#include "cache.h"
+#include "da.h"
 #include "emit_ir.h"
+#include "fold_ir.h"
+#include "intern.h"
+#include "interpret_ir.h"
 #include "ir.h"
 #include "lexer.h"
 #include "parser.h"
+#include "passes.h"
+#include "rbc.h"
 #include "rbcc.h"
+#include "server.h"
 
 #include "subprocess.h"
 #include "targets/targets.h"
 
-#define BUFFER_SIZE 1024
-
 typedef enum arg_kind {
     ARG_PRINT_AST,
     ARG_PRINT_IR,
     ARG_PRINT_ALL,
+    ARG_PRINT_NONE,
 } arg_kind;
 
 typedef struct arg {
@@ -39,49 +51,41 @@ str get_program_name(char *argv) {
 }
 
 void print_help(int exit_code, str program_name) {
-    printf("%s FILE\n", program_name.data);
+    printf("%s FILE...\n", program_name.data);
     printf("  --help       # Print this help\n");
     printf("  --print=all  # Print the ast and ir to stdout\n");
     printf("  --print=ast  # Print the ast to stdout\n");
     printf("  --print=ir   # Print the ir to stdout\n");
+    printf("  --print=none # Print only the diagnostics\n");
     printf("  --no-emit    # Do not emit any assembly or executables\n");
+    printf("  --run        # Run main in memory instead of writing a "
+           "executable, its result is the exit status\n");
+    printf("  --interpret  # Like --run, but interpret the ir instead of "
+           "generating code\n");
+    printf("  --backend=elf  # Write the object file directly (default)\n");
+    printf("  --backend=fasm # Emit assembly and assemble it with fasm\n");
+    printf("  --linker=internal # Link a static executable in process "
+           "(default)\n");
+    printf("  --linker=gcc      # Link with gcc against libc, always used "
+           "with --backend=fasm\n");
+    printf("  -O0          # Do not optimize the ir\n");
+    printf("  -O1          # Fold constants in the ir (default)\n");
+    printf("  --time-report # Print the time, allocations and memory used by "
+           "every pass to stderr\n");
+    printf("  -j N         # Compile the input files on N threads "
+           "(default 1)\n");
     printf("  -o FILE      # Specify the output file for the executable\n");
+    printf("  --cache-dir=DIR # Reuse the executables of earlier compilations "
+           "with --print=none, --backend=elf and --linker=internal\n");
+    printf("  --cache-size=N  # Keep the cache directory at most N bytes, or "
+           "with a K, M or G suffix (default 256M)\n");
+    printf("  --server=SOCKET # Compile the requests of clients on the unix "
+           "socket\n");
+    printf("  --client=SOCKET # Compile with the other arguments on the "
+           "server\n");
     exit(exit_code);
 }
 
-str fread_full(FILE *file) {
-    u8    *string  = NULL;
-    size_t str_len = 0;
-    while (true) {
-        char   buffer[BUFFER_SIZE];
-        size_t read =
-            fread(buffer, sizeof(buffer) / BUFFER_SIZE, BUFFER_SIZE, file);
-
-        if (string == NULL) {
-            string  = xmalloc(read);
-            str_len = read;
-            memcpy(string, buffer, read);
-        } else {
-            string = realloc(string, str_len + read);
-            CHECK_ALLOC(string);
-            memcpy(string + str_len, buffer, read), str_len += read;
-        }
-
-        if (read < BUFFER_SIZE) {
-            break;
-        }
-    }
-
-    string = realloc(string, str_len + 1);
-    CHECK_ALLOC(string);
-    string[str_len] = 0;
-
-    return (str){
-        .data = string,
-        .len  = str_len,
-    };
-}
-
 bool launch_program(char const *const *args, str *in_out, str *in_err) {
 
     struct subprocess_s s;
@@ -99,8 +103,8 @@ bool launch_program(char const *const *args, str *in_out, str *in_err) {
 
     FILE *out = subprocess_stdout(&s), *err = subprocess_stderr(&s);
 
-    *in_out = fread_full(out);
-    *in_err = fread_full(err);
+    *in_out = read_stream(out, 0);
+    *in_err = read_stream(err, 0);
 
     if (result != 0) {
         subprocess_destroy(&s);
@@ -111,14 +115,360 @@ bool launch_program(char const *const *args, str *in_out, str *in_err) {
     return true;
 }
 
-int main(int argc, char **argv) {
+// The state shared by the passes of one input file. Nothing is shared
+// between compilations, so they can run on different threads.
+typedef struct compilation {
+    arg_kind             print_mode;
+    str                  input_file;
+    backend              backend;
+    linker               linker;
+
+    source_file          source;
+    str                  input; // the contents of source
+    // Owns the arenas, the interner and the line table. Every phase
+    // allocates its data in its own arena, which is released at once, when
+    // the next phase does not need the data anymore.
+    rbc_context *NONNULL ctx;
+    lexer *NULLABLE      lexer;
+    parser *NULLABLE     parser;
+    program *NULLABLE    program;
+    ir_program           ir;
+    elf_object           object;
+    // Only used when linking with gcc
+    str                  fasm_file, o_file;
+
+    pass_manager         passes;
+    bool                 ok;
+} compilation;
+
+typedef struct compilations {
+    compilation *NULLABLE items;
+    size_t                count;
+    size_t                capacity;
+} compilations;
+
+// The compilations of all input files and the link, that combines them
+typedef struct driver {
+    compilations   units;
+    str            output_file;
+    // What main returned, with --run and --interpret
+    i64            result;
+    // The index of the next unit a worker compiles
+    atomic_size_t  next_unit;
+} driver;
+
+static bool pass_read(void *NONNULL state) {
+    compilation *c = state;
+    if (c->input.data != NULL) {
+        // Already read for the key of the cache
+        return true;
+    }
+    if (!read_source_file((char *)c->input_file.data, &c->source)) {
+        fprintf(stderr, "Could not open file %s: %s\n", c->input_file.data,
+                strerror(errno));
+        return false;
+    }
+    c->input = c->source.contents;
+    return true;
+}
+
+static bool pass_parse(void *NONNULL state) {
+    compilation *c = state;
+    c->lexer       =
+        lexer_new(&c->ctx->names, &c->ctx->lines, c->input_file, c->input);
+    c->parser      = parser_new(c->lexer, &c->ctx->ast_arena);
+    c->program     = parse_program(c->parser);
+    return c->lexer->errors == 0 && c->parser->errors == 0;
+}
+
+// The printing passes hold the lock of stdout, so the output of compilations
+// on other threads is not interleaved with it
+static bool pass_print_ast(void *NONNULL state) {
+    compilation *c = state;
+    flockfile(stdout);
+    program_print(c->program);
+    printf("\n");
+    funlockfile(stdout);
+    return true;
+}
+
+static bool pass_emit_ir(void *NONNULL state) {
+    compilation *c = state;
+    c->ir          = ir_emit_program(&c->ctx->ir_arena, c->program);
+
+    program_free(c->program);
+    parser_free(c->parser);
+    lexer_free(c->lexer);
+    arena_free(&c->ctx->ast_arena);
+    c->parser  = NULL;
+    c->lexer   = NULL;
+    c->program = NULL;
+    return true;
+}
+
+// Prints like the folder does by default, but counts the warnings. The cache
+// can not print them again, so compilations with warnings are not cached.
+static void fold_report(void *NULLABLE data, bool error, loc loc,
+                        char const *NONNULL fmt, va_list arg) {
+    compilation *c = data;
+    if (!error) {
+        c->ctx->warnings += 1;
+    }
+    printf("%s[%d:%d] Optimizer %s ", loc.file.data, loc.line, loc.column,
+           error ? "Error" : "Warning");
+    vprintf(fmt, arg);
+    printf("\n");
+}
+
+static bool pass_fold(void *NONNULL state) {
+    compilation *c = state;
+    return ir_fold_program_ex(&c->ctx->ir_arena, &c->ir, fold_report, c);
+}
+
+static bool pass_print_ir(void *NONNULL state) {
+    compilation *c = state;
+    flockfile(stdout);
+    ir_program_print(&c->ir);
+    funlockfile(stdout);
+    return true;
+}
+
+static bool pass_codegen_object(void *NONNULL state) {
+    compilation *c = state;
+    code_gen_object(TARGET_X86_64_LINUX, c->ir, &c->object);
+    return true;
+}
+
+static bool pass_link_internal(void *NONNULL state) {
+    driver     *d       = state;
+    elf_object *objects = xmalloc(sizeof(elf_object) * d->units.count);
+    for (size_t i = 0; i < d->units.count; i++) {
+        objects[i] = d->units.items[i].object;
+    }
+    bool ok = link_executable((char const *)d->output_file.data,
+                              TARGET_X86_64_LINUX, objects, d->units.count,
+                              S("main"));
+    if (!ok) {
+        printf("failed to link %s\n", d->output_file.data);
+    }
+    free(objects);
+    return ok;
+}
+
+static bool pass_codegen_file(void *NONNULL state) {
+    compilation *c = state;
+    switch (c->backend) {
+        case BACKEND_ELF:
+            code_gen((char const *)c->o_file.data, TARGET_X86_64_LINUX,
+                     c->backend, c->ir);
+            break;
+        case BACKEND_FASM:
+            code_gen((char const *)c->fasm_file.data, TARGET_X86_64_LINUX,
+                     c->backend, c->ir);
+            break;
+    }
+    return true;
+}
+
+static bool pass_assemble(void *NONNULL state) {
+    compilation *c   = state;
+    str          out = {0}, err = {0};
+    bool         ok  = launch_program(
+        (char const *const[]){"fasm", (char *)c->fasm_file.data,
+                              (char *)c->o_file.data, NULL},
+        &out, &err);
+    if (!ok) {
+        printf("failed to run fasm\n%s\n%s\n", out.data, err.data);
+    }
+    str_free(out);
+    str_free(err);
+    return ok;
+}
+
+static bool pass_link_gcc(void *NONNULL state) {
+    driver      *d    = state;
+    // gcc, the object files, -o, the output and the NULL
+    char const **args = xmalloc(sizeof(char *) * (d->units.count + 4));
+    size_t       argc = 0;
+    args[argc++]      = "gcc";
+    for (size_t i = 0; i < d->units.count; i++) {
+        args[argc++] = (char const *)d->units.items[i].o_file.data;
+    }
+    args[argc++] = "-o";
+    args[argc++] = (char const *)d->output_file.data;
+    args[argc++] = NULL;
+
+    str  out     = {0}, err = {0};
+    bool ok      = launch_program(args, &out, &err);
+    if (!ok) {
+        printf("failed to run gcc\n%s\n%s\n", out.data, err.data);
+    }
+    str_free(out);
+    str_free(err);
+    free(args);
+    return ok;
+}
+
+static bool pass_run(void *NONNULL state) {
+    driver     *d       = state;
+    elf_object *objects = xmalloc(sizeof(elf_object) * d->units.count);
+    for (size_t i = 0; i < d->units.count; i++) {
+        objects[i] = d->units.items[i].object;
+    }
+    bool ok = jit_run(TARGET_X86_64_LINUX, objects, d->units.count, S("main"),
+                      &d->result);
+    free(objects);
+    return ok;
+}
+
+static bool pass_interpret(void *NONNULL state) {
+    driver *d = state;
+    for (size_t i = 0; i < d->units.count; i++) {
+        compilation *c    = &d->units.items[i];
+        ir_function *main = c->ir.main_function;
+        if (!str_eq(interned_str(&c->ctx->names, main->name), S("main"))) {
+            continue;
+        }
+        u32     pos  = 0;
+        ir_trap trap = ir_interpret_function(main, &d->result, &pos);
+        if (trap != IR_TRAP_NONE) {
+            loc loc = line_table_loc(c->ir.lines, pos);
+            printf("%s[%d:%d] Interpreter Error %s\n", loc.file.data,
+                   loc.line, loc.column, ir_trap_str(trap));
+            return false;
+        }
+        return true;
+    }
+    printf("main is not defined\n");
+    return false;
+}
+
+// Parses a number of bytes, with an optional K, M or G suffix
+static bool parse_size(char const *NONNULL text, u64 *NONNULL size) {
+    char *end = NULL;
+    errno     = 0;
+    u64 value = strtoull(text, &end, 10);
+    if (end == text || errno != 0) {
+        return false;
+    }
+    u32 shift = 0;
+    if (*end == 'K') {
+        shift = 10;
+    } else if (*end == 'M') {
+        shift = 20;
+    } else if (*end == 'G') {
+        shift = 30;
+    }
+    end += shift > 0;
+    if (*end != 0 || value > (UINT64_MAX >> shift)) {
+        return false;
+    }
+    *size = value << shift;
+    return true;
+}
+
+// Hashes everything the executable depends on. The sources are read into the
+// units for it, so they are only read once. Returns false if a source can not
+// be read, the read pass reports it.
+static bool executable_key(driver *NONNULL d, backend backend, linker linker,
+                           bool optimize, cache_key *NONNULL key) {
+    cache_hasher h = cache_hasher_new();
+    cache_hash_compiler(&h);
+    cache_hash_u64(&h, TARGET_X86_64_LINUX);
+    cache_hash_u64(&h, backend);
+    cache_hash_u64(&h, linker);
+    cache_hash_u64(&h, optimize);
+    cache_hash_u64(&h, d->units.count);
+    for (size_t i = 0; i < d->units.count; i++) {
+        compilation *c = &d->units.items[i];
+        if (!read_source_file((char *)c->input_file.data, &c->source)) {
+            return false;
+        }
+        c->input = c->source.contents;
+        cache_hash_u64(&h, c->input.len);
+        cache_hash(&h, c->input.data, c->input.len);
+    }
+    *key = cache_hasher_key(&h);
+    return true;
+}
+
+static void *NULLABLE compile_worker(void *NONNULL state) {
+    driver *d = state;
+    for (;;) {
+        size_t i = atomic_fetch_add(&d->next_unit, 1);
+        if (i >= d->units.count) {
+            return NULL;
+        }
+        compilation *c = &d->units.items[i];
+        c->ok          = pass_manager_run(&c->passes, c);
+    }
+}
+
+// Compiles all units on a pool of jobs threads, the calling thread is one of
+// them. Returns false if a unit failed.
+static bool compile_units(driver *NONNULL d, u32 jobs) {
+    size_t threads = jobs < d->units.count ? jobs : d->units.count;
+    pthread_t *workers =
+        threads > 1 ? xmalloc(sizeof(pthread_t) * (threads - 1)) : NULL;
+    size_t started = 0;
+    for (; started + 1 < threads; started++) {
+        if (pthread_create(&workers[started], NULL, compile_worker, d) != 0) {
+            break;
+        }
+    }
+    compile_worker(d);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    bool ok = true;
+    for (size_t i = 0; i < d->units.count; i++) {
+        ok = ok && d->units.items[i].ok;
+    }
+    return ok;
+}
+
+static void compilation_free(compilation *NONNULL c) {
+    if (c->program) {
+        program_free(c->program);
+    }
+    if (c->parser) {
+        parser_free(c->parser);
+    }
+    if (c->lexer) {
+        lexer_free(c->lexer);
+    }
+    if (c->fasm_file.data) {
+        remove((char *)c->fasm_file.data);
+        remove((char *)c->o_file.data);
+    }
+    str_free(c->fasm_file);
+    str_free(c->o_file);
+    elf_object_free(c->object);
+    pass_manager_free(&c->passes);
+    rbc_context_free(c->ctx);
+    source_file_free(c->source);
+}
+
+static int compile_main(int argc, char **argv) {
     (void)argc;
     arg_kind print_mode       = ARG_PRINT_ALL;
 
     str      program_name     = get_program_name(argv[0]);
-    bool     found_input_file = false, found_output_file = false;
-    str      input_file, output_file;
-    bool     emit = true;
+    bool     found_output_file = false;
+    str      output_file       = {0};
+    driver   d        = {0};
+    u32      jobs     = 1;
+    bool     emit     = true;
+    bool     run      = false;
+    bool     interpret = false;
+    bool     optimize = true;
+    bool     time_report = false;
+    char const *cache_dir = NULL;
+    u64      cache_size = CACHE_MAX_SIZE;
+    backend  backend  = get_default_backend();
+    linker   linker   = get_default_linker();
     argv += 1; // skip the first argument
     while (*argv != NULL) {
         switch (**argv) {
@@ -134,10 +484,60 @@ int main(int argc, char **argv) {
                                (str){.data = (u8 *)*argv, .len = strlen(*argv)},
                                S("--print=all"))) {
                     print_mode = ARG_PRINT_ALL;
+                } else if (str_eq(
+                               (str){.data = (u8 *)*argv, .len = strlen(*argv)},
+                               S("--print=none"))) {
+                    print_mode = ARG_PRINT_NONE;
+                } else if (strncmp(*argv, "--cache-dir=",
+                                   strlen("--cache-dir=")) == 0) {
+                    cache_dir = *argv + strlen("--cache-dir=");
+                } else if (strncmp(*argv, "--cache-size=",
+                                   strlen("--cache-size=")) == 0) {
+                    if (!parse_size(*argv + strlen("--cache-size="),
+                                    &cache_size)) {
+                        printf("expected a size after --cache-size=\n");
+                        print_help(1, program_name);
+                    }
                 } else if (str_eq(
                                (str){.data = (u8 *)*argv, .len = strlen(*argv)},
                                S("--no-emit"))) {
                     emit = false;
+                } else if (str_eq(
+                               (str){.data = (u8 *)*argv, .len = strlen(*argv)},
+                               S("--run"))) {
+                    run = true;
+                } else if (str_eq(
+                               (str){.data = (u8 *)*argv, .len = strlen(*argv)},
+                               S("--interpret"))) {
+                    interpret = true;
+                } else if (str_eq(
+                               (str){.data = (u8 *)*argv, .len = strlen(*argv)},
+                               S("--backend=elf"))) {
+                    backend = BACKEND_ELF;
+                } else if (str_eq(
+                               (str){.data = (u8 *)*argv, .len = strlen(*argv)},
+                               S("--backend=fasm"))) {
+                    backend = BACKEND_FASM;
+                } else if (str_eq(
+                               (str){.data = (u8 *)*argv, .len = strlen(*argv)},
+                               S("--linker=internal"))) {
+                    linker = LINKER_INTERNAL;
+                } else if (str_eq(
+                               (str){.data = (u8 *)*argv, .len = strlen(*argv)},
+                               S("--linker=gcc"))) {
+                    linker = LINKER_GCC;
+                } else if (str_eq(
+                               (str){.data = (u8 *)*argv, .len = strlen(*argv)},
+                               S("-O0"))) {
+                    optimize = false;
+                } else if (str_eq(
+                               (str){.data = (u8 *)*argv, .len = strlen(*argv)},
+                               S("-O1"))) {
+                    optimize = true;
+                } else if (str_eq(
+                               (str){.data = (u8 *)*argv, .len = strlen(*argv)},
+                               S("--time-report"))) {
+                    time_report = true;
                 } else if (str_eq(
                                (str){.data = (u8 *)*argv, .len = strlen(*argv)},
                                S("-o"))) {
@@ -150,6 +550,16 @@ int main(int argc, char **argv) {
                             (str){.data = (u8 *)*argv, .len = strlen(*argv)};
                         found_output_file = true;
                     }
+                } else if (str_eq(
+                               (str){.data = (u8 *)*argv, .len = strlen(*argv)},
+                               S("-j"))) {
+                    argv += 1;
+                    char *end = NULL;
+                    jobs = *argv ? (u32)strtoul(*argv, &end, 10) : 0;
+                    if (jobs == 0 || *end != 0) {
+                        printf("expected a number of jobs after -j\n");
+                        print_help(1, program_name);
+                    }
                 } else if (str_eq(
                                (str){.data = (u8 *)*argv, .len = strlen(*argv)},
                                S("--help"))) {
@@ -159,114 +569,146 @@ int main(int argc, char **argv) {
                     print_help(1, program_name);
                 }
                 break;
-            default:
-                if (!found_input_file) {
-                    input_file =
-                        (str){.data = (u8 *)*argv, .len = strlen(*argv)};
-                    found_input_file = true;
-                } else {
-                    printf("unknown argument \"%s\"\n", *argv);
-                    print_help(1, program_name);
-                }
+            default: {
+                compilation c = {
+                    .input_file = (str){.data = (u8 *)*argv,
+                                        .len  = strlen(*argv)},
+                    .ctx        = rbc_context_new((rbc_options){0}),
+                };
+                da_append(&d.units, c);
+                CHECK_ALLOC(d.units.items);
+            }
         }
         argv += 1;
     }
 
-    if (!found_input_file) {
+    if (d.units.count == 0) {
         printf("no input file specified \"%s\"\n", *argv);
         print_help(1, program_name);
     }
 
-    if (!found_output_file && emit) {
+    if (!found_output_file && emit && !run && !interpret) {
         printf("no output file specified");
         print_help(1, program_name);
     }
 
-    FILE *file = fopen((char *)input_file.data, "r");
-    if (file == NULL) {
-        fprintf(stderr, "Could not open file %s\n", argv[1]);
-        return 1;
-    }
-
-    u8    *string  = NULL;
-    size_t str_len = 0;
-    while (true) {
-        char   buffer[BUFFER_SIZE];
-        size_t read =
-            fread(buffer, sizeof(buffer) / BUFFER_SIZE, BUFFER_SIZE, file);
-
-        if (string == NULL) {
-            string  = xmalloc(read);
-            str_len = read;
-            memcpy(string, buffer, read);
-        } else {
-            string = realloc(string, str_len + read);
-            CHECK_ALLOC(string);
-            memcpy(string + str_len, buffer, read), str_len += read;
+    d.output_file = output_file;
+    for (size_t i = 0; i < d.units.count; i++) {
+        compilation  *c  = &d.units.items[i];
+        pass_manager *pm = &c->passes;
+        c->print_mode    = print_mode;
+        c->backend       = backend;
+        c->linker        = linker;
+        // The fasm runs of the units on other threads can not be told apart
+        pm->no_child_time = jobs > 1 && d.units.count > 1;
+
+        pass_manager_add(pm, PASS_FRONTEND, "read", pass_read);
+        pass_manager_add(pm, PASS_FRONTEND, "parse", pass_parse);
+        if (print_mode == ARG_PRINT_AST || print_mode == ARG_PRINT_ALL) {
+            pass_manager_add(pm, PASS_FRONTEND, "print-ast", pass_print_ast);
         }
-
-        if (read < BUFFER_SIZE) {
-            break;
+        pass_manager_add(pm, PASS_FRONTEND, "emit-ir", pass_emit_ir);
+        if (optimize) {
+            pass_manager_add(pm, PASS_IR, "fold", pass_fold);
+        }
+        if (print_mode == ARG_PRINT_IR || print_mode == ARG_PRINT_ALL) {
+            pass_manager_add(pm, PASS_IR, "print-ir", pass_print_ir);
+        }
+        if (interpret) {
+            // Nothing to generate, the ir is run by pass_interpret
+        } else if (run || (emit && backend == BACKEND_ELF &&
+                           linker == LINKER_INTERNAL)) {
+            pass_manager_add(pm, PASS_BACKEND, "codegen",
+                             pass_codegen_object);
+        } else if (emit) {
+            c->fasm_file = file_name_with_suffix(c->input_file, S("fasm"));
+            c->o_file    = file_name_with_suffix(c->input_file, S("o"));
+            pass_manager_add(pm, PASS_BACKEND, "codegen", pass_codegen_file);
+            if (backend == BACKEND_FASM) {
+                pass_manager_add(pm, PASS_BACKEND, "assemble", pass_assemble);
+            }
         }
     }
-    fclose(file);
-
-    string = realloc(string, str_len + 1);
-    CHECK_ALLOC(string);
-    string[str_len] = 0;
-
-    str input       = {
-              .data = string,
-              .len  = str_len,
-    };
-
-    lexer   *l       = lexer_new(input);
 
-    parser  *p       = parser_new(l);
-
-    program *program = parse_program(p);
-    if (print_mode != ARG_PRINT_IR) {
-        program_print(program);
-        printf("\n");
+    // The link runs once for all units, after they are compiled
+    pass_manager link = {0};
+    if (interpret) {
+        pass_manager_add(&link, PASS_IR, "interpret", pass_interpret);
+    } else if (run) {
+        pass_manager_add(&link, PASS_BACKEND, "run", pass_run);
+    } else if (emit && backend == BACKEND_ELF && linker == LINKER_INTERNAL) {
+        pass_manager_add(&link, PASS_BACKEND, "link", pass_link_internal);
+    } else if (emit) {
+        pass_manager_add(&link, PASS_BACKEND, "link", pass_link_gcc);
     }
 
-    ir_program ir_program = ir_emit_program(program);
-
-    if (print_mode != ARG_PRINT_AST) {
-        ir_program_print(&ir_program);
+    // Only executables are cached, and only if the compilation prints
+    // nothing, so a hit behaves exactly like the compilation. The key does not
+    // cover fasm and gcc, so only the internal backend and linker are cached.
+    bool      cached = cache_dir != NULL && emit && !run && !interpret &&
+                  print_mode == ARG_PRINT_NONE && backend == BACKEND_ELF &&
+                  linker == LINKER_INTERNAL;
+    if (cache_dir != NULL && !cached) {
+        fprintf(stderr, "warning: --cache-dir is ignored, only executables "
+                        "written with --print=none and the internal backend "
+                        "and linker are cached\n");
     }
-
-    if (emit) {
-        str fasm_file = file_name_with_suffix(input_file, S("fasm"));
-        str o_file    = file_name_with_suffix(input_file, S("o"));
-
-        code_gen((char const *)fasm_file.data, TARGET_X86_64_LINUX, ir_program);
-
-        str out, err;
-        if (launch_program((char const *const[]){"fasm", (char *)fasm_file.data,
-                                                 (char *)o_file.data, NULL},
-                           &out, &err)) {
-            if (!launch_program(
-                    (char const *const[]){"gcc", (char *)o_file.data, "-o",
-                                          (char *)output_file.data, NULL},
-                    &out, &err)) {
-                printf("failed to run gcc\n%s\n%s\n", out.data, err.data);
+    cache_key key    = {0};
+    cached = cached && executable_key(&d, backend, linker, optimize, &key);
+    bool hit = cached && cache_fetch(cache_dir, key,
+                                     (char const *)output_file.data);
+
+    bool ok = true;
+    if (!hit) {
+        ok = compile_units(&d, jobs);
+        ok = ok && pass_manager_run(&link, &d);
+    }
+    for (size_t i = 0; i < d.units.count; i++) {
+        cached = cached && d.units.items[i].ctx->warnings == 0;
+    }
+    if (ok && cached && !hit) {
+        cache_store(cache_dir, key, (char const *)output_file.data,
+                    cache_size);
+    }
+    if (time_report) {
+        if (cached) {
+            fprintf(stderr, "cache: %s\n", hit ? "hit" : "miss");
+        }
+        for (size_t i = 0; i < d.units.count; i++) {
+            if (d.units.count > 1) {
+                fprintf(stderr, "%s:\n", d.units.items[i].input_file.data);
             }
-        } else {
-            printf("failed to run fasm\n%s\n%s\n", out.data, err.data);
+            pass_manager_report(&d.units.items[i].passes, stderr);
+        }
+        if (link.count > 0) {
+            pass_manager_report(&link, stderr);
         }
-        remove((char *)fasm_file.data);
-        remove((char *)o_file.data);
-        str_free(fasm_file);
-        str_free(o_file);
     }
 
-    ir_program_free(&ir_program);
-
-    program_free(program);
-
-    parser_free(p);
-    lexer_free(l);
+    pass_manager_free(&link);
+    for (size_t i = 0; i < d.units.count; i++) {
+        compilation_free(&d.units.items[i]);
+    }
+    da_free(&d.units);
+    if (ok && (run || interpret)) {
+        // Like the exit status of the executable
+        return (int)(d.result & 0xff);
+    }
+    return ok ? 0 : 1;
+}
 
-    free(string);
+int main(int argc, char **argv) {
+    // The server and the client run compile_main in the server, so the other
+    // arguments are only checked there
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--server=", strlen("--server=")) == 0) {
+            return server_run(argv[i] + strlen("--server="), compile_main);
+        }
+        if (strncmp(argv[i], "--client=", strlen("--client=")) == 0) {
+            char const *socket_path = argv[i] + strlen("--client=");
+            memmove(&argv[i], &argv[i + 1], sizeof(char *) * (argc - i));
+            return client_run(socket_path, argc - 1, argv);
+        }
+    }
+    return compile_main(argc, argv);
 }
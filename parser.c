@@ -3,7 +3,6 @@
 #include "ast.h"
 #include "lexer.h"
 #include "rbcc.h"
-#include "uthash.h"
 
 typedef enum precedence {
     PLOWEST,
@@ -11,8 +10,9 @@ typedef enum precedence {
     PPRODUCT,
 } precedence;
 
-static void default_error_callback(token tok, char const *fmt, va_list arg) {
-    loc     loc = tok.loc;
+static void default_error_callback(void *NULLABLE data, loc loc,
+                                   char const *fmt, va_list arg) {
+    (void)data;
     va_list arg2;
     va_copy(arg2, arg);
 
@@ -26,8 +26,9 @@ static void default_error_callback(token tok, char const *fmt, va_list arg) {
     va_end(arg2);
 }
 
-static void default_warning_callback(token tok, char const *fmt, va_list arg) {
-    loc     loc = tok.loc;
+static void default_warning_callback(void *NULLABLE data, loc loc,
+                                     char const *fmt, va_list arg) {
+    (void)data;
     va_list arg2;
     va_copy(arg2, arg);
 
@@ -46,7 +47,8 @@ static void PRINTF_FORMAT(3, 4)
     va_list arg;
     va_start(arg, fmt);
     if (p->ec != NULL) {
-        p->ec(token, fmt, arg);
+        p->ec(p->callback_data, line_table_loc(p->lexer->lines, token.pos),
+              fmt, arg);
     }
     p->errors += 1;
 
@@ -58,88 +60,106 @@ static void PRINTF_FORMAT(3, 4)
     va_list arg;
     va_start(arg, fmt);
     if (p->wc != NULL) {
-        p->wc(token, fmt, arg);
+        p->wc(p->callback_data, line_table_loc(p->lexer->lines, token.pos),
+              fmt, arg);
     }
     p->warnings += 1;
 
     va_end(arg);
 }
 
+// The token offset tokens after the current one, the last token (TEOF)
+// repeats after the end
+static token token_at(parser *NONNULL p, size_t offset) {
+    size_t index = p->cur + offset;
+    if (index >= p->tokens.count) {
+        index = p->tokens.count - 1;
+    }
+    return p->tokens.items[index];
+}
+
+static token cur_token(parser *NONNULL p) { return token_at(p, 0); }
+
+static token peek_token(parser *NONNULL p) { return token_at(p, 1); }
+
 static void next_token(parser *p) {
-    lexer_token_free(p->cur_token);
-    p->cur_token  = p->peek_token;
-    p->peek_token = lexer_scan_token(p->lexer);
+    if (p->cur + 1 < p->tokens.count) {
+        p->cur++;
+    }
 }
 
 static bool tok_is(parser *NONNULL p, token_kind kind) {
-    return p->cur_token.kind == kind;
+    return cur_token(p).kind == kind;
 }
 
 static bool tok_peek_is(parser *NONNULL p, token_kind kind) {
-    return p->peek_token.kind == kind;
+    return peek_token(p).kind == kind;
 }
 
 #define expect_msg(kind, msg, ...)                \
     if (!tok_is(p, kind)) {                       \
-        error(p, p->cur_token, msg, __VA_ARGS__); \
+        error(p, cur_token(p), msg, __VA_ARGS__); \
         return NULL;                              \
     }
 
 #define expect(k)                                                    \
     if (!tok_is(p, k)) {                                             \
-        error(p, p->cur_token, "expected token kind %s, got %s",     \
-              token_kind_str(k), token_kind_str(p->cur_token.kind)); \
+        error(p, cur_token(p), "expected token kind %s, got %s",     \
+              token_kind_str(k), token_kind_str(cur_token(p).kind)); \
         return NULL;                                                 \
     }
 
 #define expect_peek_msg(kind, msg, ...)            \
     if (!tok_peek_is(p, kind)) {                   \
-        error(p, p->peek_token, msg, __VA_ARGS__); \
+        error(p, peek_token(p), msg, __VA_ARGS__); \
         return NULL;                               \
     }                                              \
     next_token(p);
 
 #define expect_peek(k)                                                 \
     if (!tok_peek_is(p, k)) {                                          \
-        error(p, p->peek_token, "expected peek token kind %s, got %s", \
-              token_kind_str(k), token_kind_str(p->peek_token.kind));  \
+        error(p, peek_token(p), "expected peek token kind %s, got %s", \
+              token_kind_str(k), token_kind_str(peek_token(p).kind));  \
         return NULL;                                                   \
     }                                                                  \
     next_token(p);
 
-precedence get_precedence(token_kind kind) {
-    switch (kind) {
-        case TPLUS:
-        case TMINUS:
-            return PSUM;
-        case TASTERISK:
-        case TSLASH:
-            return PPRODUCT;
-        default:
-            return PLOWEST;
-    }
-}
+// The binding power of the infix operators
+static precedence const precedences[TMAX_TOKEN] = {
+    [TPLUS]     = PSUM,
+    [TMINUS]    = PSUM,
+    [TASTERISK] = PPRODUCT,
+    [TSLASH]    = PPRODUCT,
+};
+
+precedence get_precedence(token_kind kind) { return precedences[kind]; }
 
 precedence peek_precedence(parser *NONNULL p) {
-    return get_precedence(p->peek_token.kind);
+    return get_precedence(peek_token(p).kind);
 }
 
 precedence cur_precedence(parser *NONNULL p) {
-    return get_precedence(p->cur_token.kind);
+    return get_precedence(cur_token(p).kind);
 }
 
-static expr *NULLABLE parse_expr(parser *NONNULL p, precedence prec);
+static expr_id parse_expr(parser *NONNULL p, precedence prec);
 
-static expr *NULLABLE parse_constant(parser *p) {
-    expect(TCONSTANT);
+static expr_id parse_constant(parser *p) {
+    if (!tok_is(p, TCONSTANT)) {
+        error(p, cur_token(p), "expected token kind %s, got %s",
+              token_kind_str(TCONSTANT), token_kind_str(cur_token(p).kind));
+        return EXPR_NONE;
+    }
 
-    return EXPR_NEW(expr_constant, p->cur_token, p->cur_token.data.constant);
+    return expr_new(p->program, expr_constant, (u32)p->cur,
+                    cur_token(p).payload, 0);
 }
 
-static expr *NULLABLE parse_binary(parser *p, expr *lhs) {
+static expr_id parse_binary(parser *p, expr_id lhs) {
     binary_operator op;
-    token           root = p->cur_token;
-    switch (p->cur_token.kind) {
+    u32             root = (u32)p->cur;
+    token_kind      kind = cur_token(p).kind;
+    switch (cur_token(p).kind) {
         case TPLUS:
             op = BOP_ADD;
             break;
@@ -153,37 +173,33 @@ static expr *NULLABLE parse_binary(parser *p, expr *lhs) {
             op = BOP_DIV;
             break;
         default:
-            error(p, p->cur_token, "invalid token for binary expression\n");
-            return NULL;
+            error(p, cur_token(p), "invalid token for binary expression\n");
+            return EXPR_NONE;
     }
 
     next_token(p);
-    expr *rhs = parse_expr(p, get_precedence(root.kind));
-    return EXPR_NEW(expr_binary, root, op, lhs, rhs);
+    expr_id rhs = parse_expr(p, get_precedence(kind));
+    return expr_binary_new(p->program, root, op, lhs, rhs);
 }
 
-static expr *NULLABLE parse_expr(parser *NONNULL p, precedence prec) {
-    struct prefix_parse_fn_entry *entry;
-    HASH_FIND(hh, p->prefix_parse_fns, &p->cur_token.kind, sizeof(token_kind),
-              entry);
-    if (entry == NULL) {
-        error(p, p->cur_token, "could not find a prefix function for %s",
-              token_kind_str(p->cur_token.kind));
-        return NULL;
+static expr_id parse_expr(parser *NONNULL p, precedence prec) {
+    prefix_parse_fn prefix = p->prefix_parse_fns[cur_token(p).kind];
+    if (prefix == NULL) {
+        error(p, cur_token(p), "could not find a prefix function for %s",
+              token_kind_str(cur_token(p).kind));
+        return EXPR_NONE;
     }
-    expr *left_expr = entry->fn(p);
+    expr_id left_expr = prefix(p);
 
     while (!tok_peek_is(p, TSEMICOLON) && prec < peek_precedence(p)) {
-        struct infix_parse_fn_entry *infix;
-        HASH_FIND(hh, p->infix_parse_fns, &p->peek_token.kind,
-                  sizeof(token_kind), infix);
+        infix_parse_fn infix = p->infix_parse_fns[peek_token(p).kind];
         if (infix == NULL) {
             return left_expr;
         }
 
         next_token(p);
 
-        left_expr = infix->fn(p, left_expr);
+        left_expr = infix(p, left_expr);
     }
 
     return left_expr;
@@ -192,63 +208,64 @@ static expr *NULLABLE parse_expr(parser *NONNULL p, precedence prec) {
 static stmt *NULLABLE parse_function(parser *NONNULL p) {
     expect(TFN);
     expect_peek(TIDENT);
-    str_slice lit        = p->cur_token.literal;
-    str       identifier = str_slice_clone(lit);
+    name_id identifier = cur_token(p).payload;
     expect_peek(TOPEN_PAREN);
     expect_peek(TCLOSE_PAREN);
     expect_peek(TEQUAL);
     next_token(p);
-    expr *e = parse_expr(p, PLOWEST);
+    expr_id e = parse_expr(p, PLOWEST);
     expect_peek(TSEMICOLON);
-    return STMT_NEW(stmt_function, identifier, e);
+    return STMT_NEW(p->arena, stmt_function, identifier, e);
 }
 
 program *NONNULL parse_program(parser *p) {
-    return program_new((program){
-        .main_function = parse_function(p),
+    p->program          = program_new(p->arena, (program){
+        .source = p->lexer->input,
+        .names  = p->lexer->names,
+        .lines  = p->lexer->lines,
     });
+    program *prog       = p->program;
+    prog->main_function = parse_function(p);
+
+    prog->tokens        = p->tokens;
+    prog->constants     = p->lexer->constants;
+    p->tokens           = (tokens){0};
+    p->lexer->constants = (constants){0};
+    p->program          = NULL;
+    return prog;
 }
 
 void register_prefix_fn(parser *NONNULL parser, prefix_parse_fn fn,
                         token_kind kind) {
-    struct prefix_parse_fn_entry *entry =
-        xmalloc(sizeof(struct prefix_parse_fn_entry));
-    *entry = (struct prefix_parse_fn_entry){
-        .fn  = fn,
-        .key = kind,
-    };
-    HASH_ADD(hh, parser->prefix_parse_fns, key, sizeof(token_kind), entry);
+    parser->prefix_parse_fns[kind] = fn;
 }
 
 void register_infix_fn(parser *NONNULL parser, infix_parse_fn fn,
                        token_kind kind) {
-    struct infix_parse_fn_entry *entry =
-        xmalloc(sizeof(struct infix_parse_fn_entry));
-    *entry = (struct infix_parse_fn_entry){
-        .fn  = fn,
-        .key = kind,
-    };
-    HASH_ADD(hh, parser->infix_parse_fns, key, sizeof(token_kind), entry);
+    parser->infix_parse_fns[kind] = fn;
 }
 
-parser *NONNULL parser_new(lexer *l) {
-    return parser_new_ex(l, default_error_callback, default_warning_callback);
+parser *NONNULL parser_new(lexer *l, arena *NONNULL a) {
+    return parser_new_ex(l, a, default_error_callback,
+                         default_warning_callback, NULL);
 }
 
 // Sepcify additional callbacks
-parser *NONNULL parser_new_ex(lexer *l, parser_error_callback NULLABLE ec,
-                              parser_warning_callback NULLABLE wc) {
+parser *NONNULL parser_new_ex(lexer *l, arena *NONNULL a,
+                              parser_error_callback NULLABLE   ec,
+                              parser_warning_callback NULLABLE wc,
+                              void *NULLABLE callback_data) {
     parser *p = xmalloc(sizeof(parser));
     *p        = (parser){
-               .lexer            = l,
+               .lexer         = l,
 
-               .infix_parse_fns  = NULL,
-               .prefix_parse_fns = NULL,
+               .ec            = ec,
+               .wc            = wc,
+               .callback_data = callback_data,
+               .warnings      = 0,
+               .errors        = 0,
 
-               .ec               = ec,
-               .wc               = wc,
-               .warnings         = 0,
-               .errors           = 0,
+               .arena         = a,
     };
 
     register_prefix_fn(p, parse_constant, TCONSTANT);
@@ -258,29 +275,12 @@ parser *NONNULL parser_new_ex(lexer *l, parser_error_callback NULLABLE ec,
     register_infix_fn(p, parse_binary, TASTERISK);
     register_infix_fn(p, parse_binary, TSLASH);
 
-    next_token(p);
-    next_token(p);
+    p->tokens = lexer_tokenize_all(l);
 
     return p;
 }
 
 void parser_free(parser *NONNULL p) {
-
-    {
-        struct prefix_parse_fn_entry *el, *tmp;
-        HASH_ITER(hh, p->prefix_parse_fns, el, tmp) {
-            HASH_DEL(p->prefix_parse_fns, el);
-            free(el);
-        }
-    }
-    {
-        struct infix_parse_fn_entry *el, *tmp;
-        HASH_ITER(hh, p->infix_parse_fns, el, tmp) {
-            HASH_DEL(p->infix_parse_fns, el);
-            free(el);
-        }
-    }
-    lexer_token_free(p->cur_token);
-    lexer_token_free(p->peek_token);
+    free(p->tokens.items);
     free(p);
 }
@@ -2,43 +2,46 @@
 
 #include "ast.h"
 #include "lexer.h"
-#include "uthash.h"
 
 typedef struct parser parser;
 
-typedef void (*parser_error_callback)(token tok, char const *NONNULL fmt,
-                                      va_list arg);
-typedef void (*parser_warning_callback)(token tok, char const *NONNULL fmt,
-                                        va_list arg);
+// data is the callback_data the parser was created with
+typedef void (*parser_error_callback)(void *NULLABLE data, loc loc,
+                                      char const *NONNULL fmt, va_list arg);
+typedef void (*parser_warning_callback)(void *NULLABLE data, loc loc,
+                                        char const *NONNULL fmt, va_list arg);
 
-typedef expr *NULLABLE (*prefix_parse_fn)(parser *NONNULL p);
-typedef expr *NULLABLE (*infix_parse_fn)(parser *NONNULL p, expr *NONNULL expr);
+typedef expr_id (*prefix_parse_fn)(parser *NONNULL p);
+typedef expr_id (*infix_parse_fn)(parser *NONNULL p, expr_id lhs);
 
 struct parser {
     lexer *NONNULL lexer;
-    token          cur_token, peek_token;
-
-    struct prefix_parse_fn_entry {
-        token_kind              key;
-        prefix_parse_fn NONNULL fn;
-        UT_hash_handle          hh;
-    } *NONNULL prefix_parse_fns;
-    struct infix_parse_fn_entry {
-        token_kind             key;
-        infix_parse_fn NONNULL fn;
-        UT_hash_handle         hh;
-    } *NONNULL                      infix_parse_fns;
+    // All tokens of the input, cur is the index of the current one
+    tokens         tokens;
+    size_t         cur;
+
+    // Indexed by the token kind, NULL if the token can't start or continue
+    // a expression
+    prefix_parse_fn NULLABLE        prefix_parse_fns[TMAX_TOKEN];
+    infix_parse_fn NULLABLE         infix_parse_fns[TMAX_TOKEN];
 
     u32                             errors, warnings;
     parser_error_callback NONNULL   ec;
     parser_warning_callback NONNULL wc;
+    void *NULLABLE                  callback_data;
+
+    // The ast is allocated here
+    arena *NONNULL                  arena;
+    // The program parse_program is building
+    program *NULLABLE               program;
 };
 
 program *NONNULL parse_program(parser *NONNULL p);
 
-parser *NONNULL  parser_new(lexer *NONNULL l);
-parser *NONNULL  parser_new_ex(lexer *NONNULL                   l,
+parser *NONNULL  parser_new(lexer *NONNULL l, arena *NONNULL a);
+parser *NONNULL  parser_new_ex(lexer *NONNULL l, arena *NONNULL a,
                                parser_error_callback NULLABLE   ec,
-                               parser_warning_callback NULLABLE wc);
-// Frees the parser and its data, but not the lexer.
+                               parser_warning_callback NULLABLE wc,
+                               void *NULLABLE callback_data);
+// Frees the parser and its data, but not the lexer or the ast.
 void parser_free(parser *NONNULL p);
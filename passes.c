@@ -0,0 +1,123 @@
+#if defined(__linux__) || defined(__unix__)
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include "passes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "da.h"
+#include "rbcc.h"
+
+#if defined(__linux__) || defined(__unix__)
+#include <sys/resource.h>
+#endif
+
+char const *NONNULL pass_kind_str(pass_kind kind) {
+    switch (kind) {
+        case PASS_FRONTEND:
+            return "frontend";
+        case PASS_IR:
+            return "ir";
+        case PASS_BACKEND:
+            return "backend";
+    }
+    return "unknown";
+}
+
+void pass_manager_add(pass_manager *NONNULL pm, pass_kind kind,
+                      char const *NONNULL name, pass_fn NONNULL run) {
+    pass p = {.name = name, .kind = kind, .run = run};
+    da_append(pm, p);
+    CHECK_ALLOC(pm->items);
+}
+
+static f64 now_ms(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (f64)ts.tv_sec * 1000.0 + (f64)ts.tv_nsec / 1e6;
+}
+
+typedef struct usage {
+    f64  child_ms;
+    long peak_rss_kb;
+} usage;
+
+static usage get_usage(void) {
+    usage result = {0};
+#if defined(__linux__) || defined(__unix__)
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    result.peak_rss_kb = self.ru_maxrss;
+    result.child_ms =
+        (f64)(children.ru_utime.tv_sec + children.ru_stime.tv_sec) * 1000.0 +
+        (f64)(children.ru_utime.tv_usec + children.ru_stime.tv_usec) / 1000.0;
+#endif
+    return result;
+}
+
+bool pass_manager_run(pass_manager *NONNULL pm, void *NONNULL state) {
+    for (size_t i = 0; i < pm->count; i++) {
+        pass          *p            = &pm->items[i];
+        alloc_counters allocs_start = alloc_stats;
+        usage          usage_start  = get_usage();
+        f64            start        = now_ms();
+
+        bool           ok           = p->run(state);
+
+        usage          usage_end    = get_usage();
+        p->stats.ran                = true;
+        p->stats.wall_ms            = now_ms() - start;
+        p->stats.child_ms =
+            pm->no_child_time ? 0 : usage_end.child_ms - usage_start.child_ms;
+        p->stats.allocations     = alloc_stats.count - allocs_start.count;
+        p->stats.allocated_bytes = alloc_stats.bytes - allocs_start.bytes;
+        p->stats.peak_rss_growth_kb =
+            usage_end.peak_rss_kb - usage_start.peak_rss_kb;
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void print_child_ms(pass_manager const *NONNULL pm, f64 child_ms,
+                           FILE *NONNULL out) {
+    if (pm->no_child_time) {
+        fprintf(out, "%10s", "-");
+    } else {
+        fprintf(out, "%10.3f", child_ms);
+    }
+}
+
+void pass_manager_report(pass_manager const *NONNULL pm, FILE *NONNULL out) {
+    pass_stats total = {0};
+    fprintf(out, "%-12s %-9s %10s %10s %8s %10s %13s\n", "pass", "kind",
+            "wall ms", "child ms", "allocs", "alloc KiB", "peak RSS +KiB");
+    for (size_t i = 0; i < pm->count; i++) {
+        pass const *p = &pm->items[i];
+        if (!p->stats.ran) {
+            continue;
+        }
+        fprintf(out, "%-12s %-9s %10.3f ", p->name, pass_kind_str(p->kind),
+                p->stats.wall_ms);
+        print_child_ms(pm, p->stats.child_ms, out);
+        fprintf(out, " %8zu %10.1f %13ld\n", p->stats.allocations,
+                (f64)p->stats.allocated_bytes / 1024.0,
+                p->stats.peak_rss_growth_kb);
+        total.wall_ms += p->stats.wall_ms;
+        total.child_ms += p->stats.child_ms;
+        total.allocations += p->stats.allocations;
+        total.allocated_bytes += p->stats.allocated_bytes;
+        total.peak_rss_growth_kb += p->stats.peak_rss_growth_kb;
+    }
+    fprintf(out, "%-12s %-9s %10.3f ", "total", "", total.wall_ms);
+    print_child_ms(pm, total.child_ms, out);
+    fprintf(out, " %8zu %10.1f %13ld\n", total.allocations,
+            (f64)total.allocated_bytes / 1024.0, total.peak_rss_growth_kb);
+}
+
+void pass_manager_free(pass_manager *NONNULL pm) {
+    free(pm->items);
+    *pm = (pass_manager){0};
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdio.h>
+#include "rbcc.h"
+
+// The pass manager runs the registered passes in order over a shared state
+// and measures each of them, for --time-report.
+
+typedef enum pass_kind {
+    PASS_FRONTEND,
+    PASS_IR,
+    PASS_BACKEND,
+} pass_kind;
+
+char const *NONNULL pass_kind_str(pass_kind kind);
+
+// Returns false if the compilation has to stop, the pass already reported
+// the error.
+typedef bool (*pass_fn)(void *NONNULL state);
+
+typedef struct pass_stats {
+    bool   ran;
+    f64    wall_ms;
+    // CPU time of the subprocesses the pass waited for, like fasm and gcc
+    f64    child_ms;
+    size_t allocations;
+    size_t allocated_bytes;
+    // How much the pass raised the peak RSS of the process. The peak only
+    // grows, when the process needed more memory than ever before, with -j
+    // the passes on the other threads count too.
+    long   peak_rss_growth_kb;
+} pass_stats;
+
+typedef struct pass {
+    char const *NONNULL name;
+    pass_kind           kind;
+    pass_fn NONNULL     run;
+    pass_stats          stats;
+} pass;
+
+typedef struct pass_manager {
+    pass *NULLABLE items;
+    size_t         count;
+    size_t         capacity;
+    // The CPU time of subprocesses is only known for the whole process. If
+    // passes of other pass managers run on other threads at the same time,
+    // their subprocesses would be charged to this one, so it is not measured.
+    bool           no_child_time;
+} pass_manager;
+
+void pass_manager_add(pass_manager *NONNULL pm, pass_kind kind,
+                      char const *NONNULL name, pass_fn NONNULL run);
+// Runs the passes until one of them fails, returns false if one failed
+bool pass_manager_run(pass_manager *NONNULL pm, void *NONNULL state);
+void pass_manager_report(pass_manager const *NONNULL pm, FILE *NONNULL out);
+void pass_manager_free(pass_manager *NONNULL pm);
@@ -0,0 +1,110 @@
+#include "rbc.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "ast.h"
+#include "emit_ir.h"
+#include "fold_ir.h"
+#include "parser.h"
+#include "targets/targets.h"
+
+rbc_context *NONNULL rbc_context_new(rbc_options options) {
+    rbc_context *ctx = xmalloc(sizeof(rbc_context));
+    *ctx             = (rbc_context){.options = options};
+    return ctx;
+}
+
+void rbc_context_free(rbc_context *NONNULL ctx) {
+    arena_free(&ctx->ast_arena);
+    arena_free(&ctx->ir_arena);
+    interner_free(&ctx->names);
+    line_table_free(&ctx->lines);
+    free(ctx);
+}
+
+static void report(rbc_context *NONNULL ctx, rbc_severity severity,
+                   char const *NONNULL phase, loc loc, char const *NONNULL fmt,
+                   va_list arg) {
+    if (severity == RBC_ERROR) {
+        ctx->errors += 1;
+    } else {
+        ctx->warnings += 1;
+    }
+    char const *kind = severity == RBC_ERROR ? "Error" : "Warning";
+    if (ctx->options.diagnostic == NULL) {
+        printf("%s[%d:%d] %s %s ", loc.file.data, loc.line, loc.column, phase,
+               kind);
+        vprintf(fmt, arg);
+        printf("\n");
+        return;
+    }
+
+    va_list arg2;
+    va_copy(arg2, arg);
+    int   buffer_size = vsnprintf(NULL, 0, fmt, arg) + 1;
+    char *buffer      = xmalloc(buffer_size);
+    vsnprintf(buffer, buffer_size, fmt, arg2);
+    va_end(arg2);
+
+    rbc_diagnostic diagnostic = {
+        .severity = severity,
+        .phase    = phase,
+        .loc      = loc,
+        .message  = buffer,
+    };
+    ctx->options.diagnostic(ctx->options.diagnostic_data, &diagnostic);
+    free(buffer);
+}
+
+static void lexer_error(void *NULLABLE data, loc loc, char const *fmt,
+                        va_list arg) {
+    report(data, RBC_ERROR, "Lexer", loc, fmt, arg);
+}
+
+static void parser_error(void *NULLABLE data, loc loc, char const *fmt,
+                         va_list arg) {
+    report(data, RBC_ERROR, "Parser", loc, fmt, arg);
+}
+
+static void parser_warning(void *NULLABLE data, loc loc, char const *fmt,
+                           va_list arg) {
+    report(data, RBC_WARNING, "Parser", loc, fmt, arg);
+}
+
+static void fold_report(void *NULLABLE data, bool error, loc loc,
+                        char const *fmt, va_list arg) {
+    report(data, error ? RBC_ERROR : RBC_WARNING, "Optimizer", loc, fmt, arg);
+}
+
+bool rbc_compile_buffer(rbc_context *NONNULL ctx, str file, str source,
+                        bytes *NONNULL object) {
+    ctx->errors   = 0;
+    ctx->warnings = 0;
+
+    lexer     *l    = lexer_new_ex(&ctx->names, &ctx->lines, file, source,
+                                   lexer_error, ctx);
+    parser    *p    = parser_new_ex(l, &ctx->ast_arena, parser_error,
+                                    parser_warning, ctx);
+    program   *prog = parse_program(p);
+    bool       ok   = ctx->errors == 0;
+    ir_program ir   = {0};
+    if (ok) {
+        ir = ir_emit_program(&ctx->ir_arena, prog);
+    }
+    program_free(prog);
+    parser_free(p);
+    lexer_free(l);
+    arena_reset(&ctx->ast_arena);
+
+    if (ok && ctx->options.optimize) {
+        ok = ir_fold_program_ex(&ctx->ir_arena, &ir, fold_report, ctx);
+    }
+    if (ok) {
+        elf_object obj = {0};
+        code_gen_object(TARGET_X86_64_LINUX, ir, &obj);
+        elf_write_relocatable(&obj, object);
+        elf_object_free(obj);
+    }
+    arena_reset(&ctx->ir_arena);
+    return ok;
+}
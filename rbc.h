@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include "intern.h"
+#include "lexer.h"
+#include "rbcc.h"
+
+// The compiler as a library
+// A context compiles one source at a time into a ELF relocatable object, the
+// memory of a compilation is kept for the next one. Contexts share nothing,
+// so different threads can compile with their own contexts at the same time.
+
+typedef enum rbc_severity {
+    RBC_ERROR,
+    RBC_WARNING,
+} rbc_severity;
+
+typedef struct rbc_diagnostic {
+    rbc_severity        severity;
+    char const *NONNULL phase; // "Lexer", "Parser" or "Optimizer"
+    loc                 loc;
+    char const *NONNULL message;
+} rbc_diagnostic;
+
+// The diagnostic and its message are only valid during the call
+typedef void (*rbc_diagnostic_fn)(void *NULLABLE               data,
+                                  rbc_diagnostic const *NONNULL diagnostic);
+
+typedef struct rbc_options {
+    // Fold the ir, like -O1
+    bool                       optimize;
+    // NULL prints the diagnostics to stdout, like rbc does
+    rbc_diagnostic_fn NULLABLE diagnostic;
+    void *NULLABLE             diagnostic_data;
+} rbc_options;
+
+typedef struct rbc_context {
+    rbc_options options;
+    // Reset after every compilation, their blocks are reused
+    arena       ast_arena, ir_arena;
+    // The names of all compilations are interned here
+    interner    names;
+    // The lines of the last source
+    line_table  lines;
+    // Of the last compilation
+    u32         errors, warnings;
+} rbc_context;
+
+rbc_context *NONNULL rbc_context_new(rbc_options options);
+void                 rbc_context_free(rbc_context *NONNULL ctx);
+
+// Compiles the source and appends the ELF relocatable object to object. file
+// is the name used in the diagnostics. Like every str, the source has to be
+// followed by a zero byte. Returns false if there were errors, they were
+// reported to the diagnostic callback.
+bool rbc_compile_buffer(rbc_context *NONNULL ctx, str file, str source,
+                        bytes *NONNULL object);
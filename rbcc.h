@@ -48,12 +48,33 @@ static_assert(sizeof(u8) == sizeof(char),
         abort();                                                          \
     }
 
+// Counts the allocations made with xmalloc and xrealloc, which includes the
+// arena blocks and the growth of every da, for --time-report. Every thread has
+// its own counters.
+typedef struct alloc_counters {
+    size_t count;
+    size_t bytes;
+} alloc_counters;
+
+extern _Thread_local alloc_counters alloc_stats;
+
 inline void *NONNULL xmalloc(size_t size) {
+    alloc_stats.count++;
+    alloc_stats.bytes += size;
     void *result = malloc(size);
     CHECK_ALLOC(result);
     return result;
 }
 
+// A growth counts as a allocation of the new size
+inline void *NONNULL xrealloc(void *NULLABLE ptr, size_t size) {
+    alloc_stats.count++;
+    alloc_stats.bytes += size;
+    void *result = realloc(ptr, size);
+    CHECK_ALLOC(result);
+    return result;
+}
+
 char *NONNULL PRINTF_FORMAT(1, 2) alloc_print(char const *NONNULL fmt, ...);
 struct str    PRINTF_FORMAT(1, 2) alloc_print_str(char const *NONNULL fmt, ...);
 
@@ -84,11 +105,70 @@ str  str_slice_clone(str_slice slice);
 str  str_clone(str s);
 void str_free(str s);
 
-// File utils
-str file_name_with_suffix(str file_name, str suffix);
-
-// Other utils
-
-// Returns a unique string in this format: 'tmp.X'
-str str_unique(void);
+// Arenas
+// A bump pointer allocator, everything allocated from a arena is released at
+// once by arena_free. A zero initialized arena is empty and ready to use.
+// The compiler uses one arena per phase (lexing/ast, ir and codegen), so
+// there are no free functions for the data structures of these phases.
+typedef struct arena_block arena_block;
+typedef struct arena {
+    arena_block *NULLABLE blocks;
+} arena;
+
+// The memory is aligned for any type and is not initialized
+void *NONNULL arena_alloc(arena *NONNULL a, size_t size);
+// Grows a allocation, it is extended in place if it was the last one
+void *NONNULL arena_realloc(arena *NONNULL a, void *NULLABLE ptr,
+                            size_t old_size, size_t new_size);
+str           arena_str_clone(arena *NONNULL a, str s);
+str           arena_slice_clone(arena *NONNULL a, str_slice slice);
+str PRINTF_FORMAT(2, 3)
+    arena_print_str(arena *NONNULL a, char const *NONNULL fmt, ...);
+// Releases all the memory of the arena, it can be reused afterwards
+void arena_free(arena *NONNULL a);
+// Releases everything allocated from the arena, but keeps its newest block
+// for the next allocations
+void arena_reset(arena *NONNULL a);
+
+// Byte buffers
+// A growable buffer of raw bytes, it has the same layout as a da, so the da
+// macros work on it too. Multi byte integers are always appended as little
+// endian, independent of the host.
+typedef struct bytes {
+    u8 *NULLABLE items;
+    size_t       count;
+    size_t       capacity;
+} bytes;
+
+void bytes_append(bytes *NONNULL b, void const *NULLABLE data, size_t len);
+void bytes_u8(bytes *NONNULL b, u8 value);
+void bytes_u16(bytes *NONNULL b, u16 value);
+void bytes_u32(bytes *NONNULL b, u32 value);
+void bytes_u64(bytes *NONNULL b, u64 value);
+// Pads the buffer with zeros until count is a multiple of align
+void bytes_align(bytes *NONNULL b, size_t align);
+// Overwrites 4 already appended bytes at offset
+void bytes_patch_u32(bytes *NONNULL b, size_t offset, u32 value);
+void bytes_free(bytes b);
 
+// File utils
+str  file_name_with_suffix(str file_name, str suffix);
+// Writes the bytes to the file, returns false and sets errno on failure.
+bool write_file(char const *NONNULL file_name, bytes content);
+// Sets the executable bits of the file, returns false and sets errno on failure.
+bool make_executable(char const *NONNULL file_name);
+
+// A source file in memory, the contents are always followed by a zero byte,
+// which the lexer uses to find the end.
+typedef struct source_file {
+    str    contents;
+    size_t mapped; // the size of the mapping, 0 if the contents are allocated
+} source_file;
+
+// Maps the file read only, files that can't be mapped, like pipes, are read
+// into a single allocation. Returns false and sets errno on failure.
+bool read_source_file(char const *NONNULL file_name, source_file *NONNULL out);
+void source_file_free(source_file file);
+// Reads the stream until its end, size_hint is the expected size or 0 if it
+// is unknown. The result is followed by a zero byte.
+str  read_stream(FILE *NONNULL file, size_t size_hint);
@@ -0,0 +1,353 @@
+#if defined(__linux__) || defined(__unix__)
+#define _GNU_SOURCE // memfd_create
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define HAS_SERVER 1
+#else
+#define HAS_SERVER 0
+#endif
+#include "server.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rbc.h"
+#include "rbcc.h"
+
+// The protocol, all integers are little endian
+// request: u32 count, count times u32 length and the bytes of a string. The
+//          first string is the working directory, the others are the argv.
+// reply:   u32 exit status, u64 stdout length, u64 stderr length, followed by
+//          stdout and stderr
+#define REQUEST_MAX_STRINGS 4096
+#define REQUEST_MAX_STRING  (1u << 20)
+#define REPLY_HEADER_SIZE   (4 + 8 + 8)
+
+#if HAS_SERVER
+
+static bool write_all(int fd, void const *NONNULL data, size_t len) {
+    u8 const *p = data;
+    while (len > 0) {
+        ssize_t written = write(fd, p, len);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        p   += written;
+        len -= (size_t)written;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void *NONNULL data, size_t len) {
+    u8 *p = data;
+    while (len > 0) {
+        ssize_t got = read(fd, p, len);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        p   += got;
+        len -= (size_t)got;
+    }
+    return true;
+}
+
+static u64 read_le(u8 const *NONNULL p, size_t size) {
+    u64 value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= (u64)p[i] << (8 * i);
+    }
+    return value;
+}
+
+static bool read_u32(int fd, u32 *NONNULL value) {
+    u8 buffer[4];
+    if (!read_all(fd, buffer, sizeof(buffer))) {
+        return false;
+    }
+    *value = (u32)read_le(buffer, sizeof(buffer));
+    return true;
+}
+
+static void append_string(bytes *NONNULL b, char const *NONNULL s) {
+    size_t len = strlen(s);
+    bytes_u32(b, (u32)len);
+    bytes_append(b, s, len);
+}
+
+static bool socket_address(char const *NONNULL socket_path,
+                           struct sockaddr_un *NONNULL addr) {
+    *addr = (struct sockaddr_un){.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "socket path %s is too long\n", socket_path);
+        return false;
+    }
+    strcpy(addr->sun_path, socket_path);
+    return true;
+}
+
+// Reads the strings of the request, strings[0] is the working directory
+static bool read_request(int conn, char **NONNULL *NONNULL strings,
+                         u32 *NONNULL count) {
+    if (!read_u32(conn, count) || *count < 2 ||
+        *count > REQUEST_MAX_STRINGS) {
+        return false;
+    }
+    // One more for the NULL, that ends the argv
+    *strings = xmalloc(sizeof(char *) * (*count + 1));
+    for (u32 i = 0; i < *count; i++) {
+        u32 len = 0;
+        if (!read_u32(conn, &len) || len > REQUEST_MAX_STRING) {
+            return false;
+        }
+        (*strings)[i] = xmalloc(len + 1);
+        if (!read_all(conn, (*strings)[i], len)) {
+            return false;
+        }
+        (*strings)[i][len] = 0;
+    }
+    (*strings)[*count] = NULL;
+    return true;
+}
+
+// The output of the worker, in memory if possible
+static FILE *NULLABLE output_file(char const *NONNULL name) {
+#if defined(__linux__)
+    int fd = memfd_create(name, 0);
+    if (fd >= 0) {
+        return fdopen(fd, "w+");
+    }
+#else
+    (void)name;
+#endif
+    return tmpfile();
+}
+
+// Runs the request in a worker and sends its output back. The worker is a
+// fork of the connection, so the exit status is known even if main_fn exits
+// early or crashes.
+static void serve_connection(int conn, server_main_fn main_fn) {
+    char **strings = NULL;
+    u32    count   = 0;
+    if (!read_request(conn, &strings, &count)) {
+        return;
+    }
+    FILE *out = output_file("stdout");
+    FILE *err = output_file("stderr");
+    if (out == NULL || err == NULL) {
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fileno(out), STDOUT_FILENO);
+        dup2(fileno(err), STDERR_FILENO);
+        close(conn);
+        if (chdir(strings[0]) != 0) {
+            fprintf(stderr, "could not change to directory %s: %s\n",
+                    strings[0], strerror(errno));
+            exit(1);
+        }
+        exit(main_fn((int)count - 1, strings + 1));
+    }
+    int status = 1;
+    if (pid > 0 && waitpid(pid, &status, 0) == pid) {
+        status = WIFEXITED(status) ? WEXITSTATUS(status)
+                                   : 128 + WTERMSIG(status);
+    }
+
+    // The worker wrote through the same file descriptions
+    rewind(out);
+    rewind(err);
+    str   out_str = read_stream(out, 0);
+    str   err_str = read_stream(err, 0);
+    bytes reply   = {0};
+    bytes_u32(&reply, (u32)status);
+    bytes_u64(&reply, out_str.len);
+    bytes_u64(&reply, err_str.len);
+    bytes_append(&reply, out_str.data, out_str.len);
+    bytes_append(&reply, err_str.data, err_str.len);
+    write_all(conn, reply.items, reply.count);
+}
+
+// Removes the socket a killed server left behind. Returns false if the path
+// is something else, or if a server still answers on it.
+static bool remove_stale_socket(char const *NONNULL           socket_path,
+                                struct sockaddr_un const *NONNULL addr) {
+    struct stat st;
+    if (lstat(socket_path, &st) != 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        fprintf(stderr, "could not check %s: %s\n", socket_path,
+                strerror(errno));
+        return false;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "%s exists and is not a socket\n", socket_path);
+        return false;
+    }
+    // The socket of a dead server refuses the connection
+    int  probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool live  = false;
+    if (probe >= 0) {
+        live = connect(probe, (struct sockaddr const *)addr,
+                       sizeof(*addr)) == 0;
+        close(probe);
+    }
+    if (live) {
+        fprintf(stderr, "a server is already listening on %s\n", socket_path);
+        return false;
+    }
+    unlink(socket_path);
+    return true;
+}
+
+// Faults the code and tables of the compiler in, the workers share the pages
+// with the server
+static void warm_up(void) {
+    rbc_context *ctx    = rbc_context_new((rbc_options){.optimize = true});
+    bytes        object = {0};
+    rbc_compile_buffer(ctx, S("warm-up.rbc"), S("fn main() = 1 + 2 * 3;\n"),
+                       &object);
+    bytes_free(object);
+    rbc_context_free(ctx);
+}
+
+int server_run(char const *NONNULL socket_path, server_main_fn main_fn) {
+    struct sockaddr_un addr;
+    if (!socket_address(socket_path, &addr)) {
+        return 1;
+    }
+    if (!remove_stale_socket(socket_path, &addr)) {
+        return 1;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("socket");
+        return 1;
+    }
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listener, SOMAXCONN) != 0) {
+        fprintf(stderr, "could not listen on %s: %s\n", socket_path,
+                strerror(errno));
+        close(listener);
+        return 1;
+    }
+
+    warm_up();
+    // The connections are never waited for, so they do not become zombies
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "listening on %s\n", socket_path);
+    fflush(NULL);
+    for (;;) {
+        int conn = accept(listener, NULL, NULL);
+        if (conn < 0) {
+            if (errno != EINTR) {
+                perror("accept");
+            }
+            continue;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listener);
+            // The connection waits for its worker
+            signal(SIGCHLD, SIG_DFL);
+            serve_connection(conn, main_fn);
+            _exit(0);
+        }
+        if (pid < 0) {
+            perror("fork");
+        }
+        close(conn);
+    }
+}
+
+// Copies len bytes of the reply to the file
+static bool forward_output(int conn, FILE *NONNULL file, u64 len) {
+    u8 buffer[1 << 16];
+    while (len > 0) {
+        size_t chunk = len < sizeof(buffer) ? (size_t)len : sizeof(buffer);
+        if (!read_all(conn, buffer, chunk)) {
+            return false;
+        }
+        fwrite(buffer, 1, chunk, file);
+        len -= chunk;
+    }
+    return true;
+}
+
+int client_run(char const *NONNULL socket_path, int argc,
+               char *NULLABLE *NONNULL argv) {
+    struct sockaddr_un addr;
+    if (!socket_address(socket_path, &addr)) {
+        return 1;
+    }
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("getcwd");
+        return 1;
+    }
+    int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn < 0) {
+        perror("socket");
+        return 1;
+    }
+    if (connect(conn, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "could not connect to %s: %s\n", socket_path,
+                strerror(errno));
+        close(conn);
+        return 1;
+    }
+
+    bytes request = {0};
+    bytes_u32(&request, (u32)argc + 1);
+    append_string(&request, cwd);
+    for (int i = 0; i < argc; i++) {
+        append_string(&request, argv[i]);
+    }
+    bool ok = write_all(conn, request.items, request.count);
+    bytes_free(request);
+
+    u8 header[REPLY_HEADER_SIZE];
+    ok = ok && read_all(conn, header, sizeof(header));
+    ok = ok && forward_output(conn, stdout, read_le(header + 4, 8));
+    ok = ok && forward_output(conn, stderr, read_le(header + 12, 8));
+    close(conn);
+    if (!ok) {
+        fprintf(stderr, "the server at %s did not reply\n", socket_path);
+        return 1;
+    }
+    return (int)read_le(header, 4);
+}
+
+#else
+
+int server_run(char const *NONNULL socket_path, server_main_fn main_fn) {
+    (void)socket_path;
+    (void)main_fn;
+    fprintf(stderr, "the compile server is not supported on this host\n");
+    return 1;
+}
+
+int client_run(char const *NONNULL socket_path, int argc,
+               char *NULLABLE *NONNULL argv) {
+    (void)socket_path;
+    (void)argc;
+    (void)argv;
+    fprintf(stderr, "the compile server is not supported on this host\n");
+    return 1;
+}
+
+#endif
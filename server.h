@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include "rbcc.h"
+
+// A compile server on a unix socket, that keeps the compiler loaded between
+// compilations. The client forwards its arguments and working directory, the
+// server runs them with main_fn in a forked worker and sends back what the
+// worker printed to stdout and stderr and its exit status.
+
+typedef int (*server_main_fn)(int argc, char *NULLABLE *NONNULL argv);
+
+// Serves the connections until the server is killed, returns the exit status
+// if it could not listen on the socket
+int server_run(char const *NONNULL socket_path, server_main_fn main_fn);
+
+// Runs the arguments on the server and prints its output, returns the exit
+// status of the compilation
+int client_run(char const *NONNULL socket_path, int argc,
+               char *NULLABLE *NONNULL argv);
@@ -59,8 +59,49 @@ str str_clone(str s) {
 
 void str_free(str s) { free(s.data); }
 
+void bytes_append(bytes *NONNULL b, void const *NULLABLE data, size_t len) {
+    if (b->count + len > b->capacity) {
+        size_t cap = b->capacity == 0 ? 64 : b->capacity;
+        while (cap < b->count + len) {
+            cap *= 2;
+        }
+        b->items = xrealloc(b->items, cap);
+        b->capacity = cap;
+    }
+    if (len > 0) {
+        memcpy(b->items + b->count, data, len);
+    }
+    b->count += len;
+}
+
+void bytes_u8(bytes *NONNULL b, u8 value) { bytes_append(b, &value, 1); }
+
+void bytes_u16(bytes *NONNULL b, u16 value) {
+    u8 buffer[2] = {value & 0xff, value >> 8};
+    bytes_append(b, buffer, sizeof(buffer));
+}
+
+void bytes_u32(bytes *NONNULL b, u32 value) {
+    bytes_u16(b, value & 0xffff);
+    bytes_u16(b, value >> 16);
+}
+
+void bytes_u64(bytes *NONNULL b, u64 value) {
+    bytes_u32(b, value & 0xffffffff);
+    bytes_u32(b, value >> 32);
+}
+
+void bytes_align(bytes *NONNULL b, size_t align) {
+    while (b->count % align != 0) {
+        bytes_u8(b, 0);
+    }
+}
 
-str str_unique(void) {
-    static u64 counter = 0;
-    return alloc_print_str("tmp.%ld", counter++);
+void bytes_patch_u32(bytes *NONNULL b, size_t offset, u32 value) {
+    assert(offset + 4 <= b->count);
+    for (size_t i = 0; i < 4; i++) {
+        b->items[offset + i] = (value >> (i * 8)) & 0xff;
+    }
 }
+
+void bytes_free(bytes b) { free(b.items); }
@@ -0,0 +1,554 @@
+#include "elf.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "da.h"
+#include "rbcc.h"
+
+// Only the parts of the ELF64 specification we need, we do not depend on
+// <elf.h> so this also builds on non linux hosts.
+#define ELFCLASS64    2
+#define ELFDATA2LSB   1
+#define EV_CURRENT    1
+#define ET_REL        1
+#define ET_EXEC       2
+#define EM_X86_64     62
+
+#define SHT_PROGBITS  1
+#define SHT_SYMTAB    2
+#define SHT_STRTAB    3
+#define SHT_RELA      4
+
+#define SHF_ALLOC     0x2
+#define SHF_EXECINSTR 0x4
+#define SHF_INFO_LINK 0x40
+
+#define STB_LOCAL     0
+#define STB_GLOBAL    1
+#define STT_NOTYPE    0
+#define STT_FUNC      2
+#define STT_SECTION   3
+
+#define R_X86_64_PC32  2
+#define R_X86_64_PLT32 4
+
+#define PT_LOAD       1
+#define PT_GNU_STACK  0x6474e551
+#define PF_X          0x1
+#define PF_W          0x2
+#define PF_R          0x4
+
+#define EHDR_SIZE     64
+#define PHDR_SIZE     56
+#define SHDR_SIZE     64
+#define SYM_SIZE      24
+#define RELA_SIZE     24
+
+u32 elf_object_symbol(elf_object *NONNULL obj, str name) {
+    for (size_t i = 0; i < obj->symbols.count; i++) {
+        if (str_eq(obj->symbols.items[i].name, name)) {
+            return i;
+        }
+    }
+
+    elf_symbol sym = {
+        .name    = str_clone(name),
+        .value   = 0,
+        .size    = 0,
+        .global  = true,
+        .defined = false,
+    };
+    da_append(&obj->symbols, sym);
+    return obj->symbols.count - 1;
+}
+
+u32 elf_object_define(elf_object *NONNULL obj, str name, bool global) {
+    u32         index = elf_object_symbol(obj, name);
+    elf_symbol *sym   = &obj->symbols.items[index];
+    sym->value        = obj->text.count;
+    sym->global       = global;
+    sym->defined      = true;
+    return index;
+}
+
+void elf_object_reloc(elf_object *NONNULL obj, elf_reloc_kind kind, u32 symbol,
+                      i64 addend) {
+    elf_reloc reloc = {
+        .offset = obj->text.count,
+        .symbol = symbol,
+        .addend = addend,
+        .kind   = kind,
+    };
+    da_append(&obj->relocs, reloc);
+    bytes_u32(&obj->text, 0);
+}
+
+void elf_object_free(elf_object obj) {
+    for (size_t i = 0; i < obj.symbols.count; i++) {
+        str_free(obj.symbols.items[i].name);
+    }
+    da_free(&obj.symbols);
+    da_free(&obj.relocs);
+    bytes_free(obj.text);
+}
+
+static u32 strtab_add(bytes *NONNULL strtab, str s) {
+    u32 offset = strtab->count;
+    bytes_append(strtab, s.data, s.len);
+    bytes_u8(strtab, 0);
+    return offset;
+}
+
+typedef struct section_header {
+    u32 name;
+    u32 type;
+    u64 flags;
+    u64 addr;
+    u64 offset;
+    u64 size;
+    u32 link;
+    u32 info;
+    u64 addralign;
+    u64 entsize;
+} section_header;
+
+static void write_section_header(bytes *NONNULL out, section_header sh) {
+    bytes_u32(out, sh.name);
+    bytes_u32(out, sh.type);
+    bytes_u64(out, sh.flags);
+    bytes_u64(out, sh.addr);
+    bytes_u64(out, sh.offset);
+    bytes_u64(out, sh.size);
+    bytes_u32(out, sh.link);
+    bytes_u32(out, sh.info);
+    bytes_u64(out, sh.addralign);
+    bytes_u64(out, sh.entsize);
+}
+
+static void write_symbol(bytes *NONNULL out, u32 name, u8 bind, u8 type,
+                         u16 shndx, u64 value, u64 size) {
+    bytes_u32(out, name);
+    bytes_u8(out, (bind << 4) | type);
+    bytes_u8(out, 0); // st_other, default visibility
+    bytes_u16(out, shndx);
+    bytes_u64(out, value);
+    bytes_u64(out, size);
+}
+
+// Overwrites the reserved space at start with the elf header
+static void write_elf_header(bytes *NONNULL out, size_t start, u16 type,
+                             u64 entry, u64 phoff, u16 phnum, u64 shoff,
+                             u16 shnum, u16 shstrndx) {
+    bytes header = {0};
+    bytes_append(&header, "\x7f"
+                          "ELF",
+                 4);
+    bytes_u8(&header, ELFCLASS64);
+    bytes_u8(&header, ELFDATA2LSB);
+    bytes_u8(&header, EV_CURRENT);
+    bytes_u8(&header, 0); // ELFOSABI_SYSV
+    bytes_align(&header, 16);
+    bytes_u16(&header, type);
+    bytes_u16(&header, EM_X86_64);
+    bytes_u32(&header, EV_CURRENT);
+    bytes_u64(&header, entry);
+    bytes_u64(&header, phoff);
+    bytes_u64(&header, shoff);
+    bytes_u32(&header, 0); // e_flags
+    bytes_u16(&header, EHDR_SIZE);
+    bytes_u16(&header, phnum > 0 ? PHDR_SIZE : 0);
+    bytes_u16(&header, phnum);
+    bytes_u16(&header, SHDR_SIZE);
+    bytes_u16(&header, shnum);
+    bytes_u16(&header, shstrndx);
+    assert(header.count == EHDR_SIZE);
+    memcpy(out->items + start, header.items, EHDR_SIZE);
+    bytes_free(header);
+}
+
+enum {
+    SEC_NULL,
+    SEC_TEXT,
+    SEC_RELA_TEXT,
+    SEC_SYMTAB,
+    SEC_STRTAB,
+    SEC_SHSTRTAB,
+    SEC_NOTE_GNU_STACK,
+    SEC_COUNT,
+};
+
+void elf_write_relocatable(elf_object *NONNULL obj, bytes *NONNULL out) {
+    bytes shstrtab = {0};
+    u32   names[SEC_COUNT];
+    bytes_u8(&shstrtab, 0);
+    names[SEC_NULL]           = 0;
+    names[SEC_TEXT]           = strtab_add(&shstrtab, S(".text"));
+    names[SEC_RELA_TEXT]      = strtab_add(&shstrtab, S(".rela.text"));
+    names[SEC_SYMTAB]         = strtab_add(&shstrtab, S(".symtab"));
+    names[SEC_STRTAB]         = strtab_add(&shstrtab, S(".strtab"));
+    names[SEC_SHSTRTAB]       = strtab_add(&shstrtab, S(".shstrtab"));
+    names[SEC_NOTE_GNU_STACK] = strtab_add(&shstrtab, S(".note.GNU-stack"));
+
+    // The symbol table has to list all local symbols before the global ones,
+    // so the object symbols get remapped.
+    bytes strtab = {0}, symtab = {0};
+    u32  *sym_map = xmalloc(sizeof(u32) * (obj->symbols.count + 1));
+    bytes_u8(&strtab, 0);
+    write_symbol(&symtab, 0, STB_LOCAL, STT_NOTYPE, 0, 0, 0);
+    write_symbol(&symtab, 0, STB_LOCAL, STT_SECTION, SEC_TEXT, 0, 0);
+    u32 sym_count = 2, first_global = 2;
+    for (int pass = 0; pass < 2; pass++) {
+        bool want_global = pass == 1;
+        if (want_global) {
+            first_global = sym_count;
+        }
+        for (size_t i = 0; i < obj->symbols.count; i++) {
+            elf_symbol sym = obj->symbols.items[i];
+            if ((sym.global || !sym.defined) != want_global) {
+                continue;
+            }
+            write_symbol(&symtab, strtab_add(&strtab, sym.name),
+                         want_global ? STB_GLOBAL : STB_LOCAL,
+                         sym.defined ? STT_FUNC : STT_NOTYPE,
+                         sym.defined ? SEC_TEXT : 0, sym.value, sym.size);
+            sym_map[i] = sym_count++;
+        }
+    }
+
+    bytes rela = {0};
+    for (size_t i = 0; i < obj->relocs.count; i++) {
+        elf_reloc reloc = obj->relocs.items[i];
+        u32 type = reloc.kind == ELF_RELOC_PLT32 ? R_X86_64_PLT32 : R_X86_64_PC32;
+        bytes_u64(&rela, reloc.offset);
+        bytes_u64(&rela, ((u64)sym_map[reloc.symbol] << 32) | type);
+        bytes_u64(&rela, (u64)reloc.addend);
+    }
+    free(sym_map);
+
+    section_header sections[SEC_COUNT] = {0};
+    size_t header_start = out->count;
+    // Reserve space for the elf header, it is written at the end, when all
+    // offsets are known.
+    for (size_t i = 0; i < EHDR_SIZE; i++) {
+        bytes_u8(out, 0);
+    }
+
+    bytes_align(out, 16);
+    sections[SEC_TEXT] = (section_header){
+        .type      = SHT_PROGBITS,
+        .flags     = SHF_ALLOC | SHF_EXECINSTR,
+        .offset    = out->count - header_start,
+        .size      = obj->text.count,
+        .addralign = 16,
+    };
+    bytes_append(out, obj->text.items, obj->text.count);
+
+    bytes_align(out, 8);
+    sections[SEC_RELA_TEXT] = (section_header){
+        .type      = SHT_RELA,
+        .flags     = SHF_INFO_LINK,
+        .offset    = out->count - header_start,
+        .size      = rela.count,
+        .link      = SEC_SYMTAB,
+        .info      = SEC_TEXT,
+        .addralign = 8,
+        .entsize   = RELA_SIZE,
+    };
+    bytes_append(out, rela.items, rela.count);
+
+    bytes_align(out, 8);
+    sections[SEC_SYMTAB] = (section_header){
+        .type      = SHT_SYMTAB,
+        .offset    = out->count - header_start,
+        .size      = symtab.count,
+        .link      = SEC_STRTAB,
+        .info      = first_global,
+        .addralign = 8,
+        .entsize   = SYM_SIZE,
+    };
+    bytes_append(out, symtab.items, symtab.count);
+
+    sections[SEC_STRTAB] = (section_header){
+        .type      = SHT_STRTAB,
+        .offset    = out->count - header_start,
+        .size      = strtab.count,
+        .addralign = 1,
+    };
+    bytes_append(out, strtab.items, strtab.count);
+
+    sections[SEC_SHSTRTAB] = (section_header){
+        .type      = SHT_STRTAB,
+        .offset    = out->count - header_start,
+        .size      = shstrtab.count,
+        .addralign = 1,
+    };
+    bytes_append(out, shstrtab.items, shstrtab.count);
+
+    // Marks the stack as non executable, otherwise ld warns about it.
+    sections[SEC_NOTE_GNU_STACK] = (section_header){
+        .type      = SHT_PROGBITS,
+        .offset    = out->count - header_start,
+        .addralign = 1,
+    };
+
+    bytes_align(out, 8);
+    u64 shoff = out->count - header_start;
+    for (size_t i = 0; i < SEC_COUNT; i++) {
+        sections[i].name = names[i];
+        write_section_header(out, sections[i]);
+    }
+
+    write_elf_header(out, header_start, ET_REL, 0, 0, 0, shoff, SEC_COUNT,
+                     SEC_SHSTRTAB);
+
+    bytes_free(rela);
+    bytes_free(symtab);
+    bytes_free(strtab);
+    bytes_free(shstrtab);
+}
+
+// The address the executable gets loaded at, the same as the default of ld
+#define EXEC_BASE 0x400000
+
+typedef struct linked_symbol {
+    str NONNULL name;
+    u64         addr;
+} linked_symbol;
+
+typedef struct linked_symbols {
+    linked_symbol *NULLABLE items;
+    size_t                  count;
+    size_t                  capacity;
+} linked_symbols;
+
+static linked_symbol *NULLABLE find_global(linked_symbols *NONNULL globals,
+                                           str                     name) {
+    for (size_t i = 0; i < globals->count; i++) {
+        if (str_eq(globals->items[i].name, name)) {
+            return &globals->items[i];
+        }
+    }
+    return NULL;
+}
+
+static void write_program_header(bytes *NONNULL out, u32 type, u32 flags,
+                                 u64 offset, u64 addr, u64 size, u64 align) {
+    bytes_u32(out, type);
+    bytes_u32(out, flags);
+    bytes_u64(out, offset);
+    bytes_u64(out, addr);
+    bytes_u64(out, addr); // p_paddr
+    bytes_u64(out, size); // p_filesz
+    bytes_u64(out, size); // p_memsz
+    bytes_u64(out, align);
+}
+
+enum {
+    EXEC_SEC_NULL,
+    EXEC_SEC_TEXT,
+    EXEC_SEC_SYMTAB,
+    EXEC_SEC_STRTAB,
+    EXEC_SEC_SHSTRTAB,
+    EXEC_SEC_COUNT,
+};
+
+size_t elf_linked_text_size(elf_object const *NONNULL objects, size_t count) {
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) {
+        size = (size + 15) & ~(size_t)15;
+        size += objects[i].text.count;
+    }
+    return size;
+}
+
+// Merges the .text of the objects into text, which is loaded at addr, and
+// resolves the relocations. The defined global symbols are added to globals.
+static bool link_text(elf_object const *NONNULL objects, size_t count,
+                      u64 addr, bytes *NONNULL text,
+                      linked_symbols *NONNULL globals) {
+    u64 *bases = xmalloc(sizeof(u64) * (count + 1));
+    bool ok    = true;
+    for (size_t i = 0; i < count; i++) {
+        bytes_align(text, 16);
+        bases[i] = text->count;
+        bytes_append(text, objects[i].text.items, objects[i].text.count);
+
+        for (size_t j = 0; j < objects[i].symbols.count; j++) {
+            elf_symbol sym = objects[i].symbols.items[j];
+            if (!sym.defined || !sym.global) {
+                continue;
+            }
+            if (find_global(globals, sym.name) != NULL) {
+                fprintf(stderr, "(linker) symbol %s is defined more than once\n",
+                        sym.name.data);
+                ok = false;
+                continue;
+            }
+            linked_symbol linked = {
+                .name = sym.name,
+                .addr = addr + bases[i] + sym.value,
+            };
+            da_append(globals, linked);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < objects[i].relocs.count; j++) {
+            elf_reloc  reloc = objects[i].relocs.items[j];
+            elf_symbol sym   = objects[i].symbols.items[reloc.symbol];
+            u64        target;
+            if (sym.defined && !sym.global) {
+                target = addr + bases[i] + sym.value;
+            } else {
+                linked_symbol *global = find_global(globals, sym.name);
+                if (global == NULL) {
+                    fprintf(stderr, "(linker) undefined symbol %s\n",
+                            sym.name.data);
+                    ok = false;
+                    continue;
+                }
+                target = global->addr;
+            }
+
+            u64 place = addr + bases[i] + reloc.offset;
+            i64 value = (i64)(target + reloc.addend - place);
+            if (value < INT32_MIN || value > INT32_MAX) {
+                fprintf(stderr, "(linker) relocation against %s out of range\n",
+                        sym.name.data);
+                ok = false;
+                continue;
+            }
+            bytes_patch_u32(text, bases[i] + reloc.offset, (u32)(i32)value);
+        }
+    }
+    free(bases);
+    return ok;
+}
+
+bool elf_link_text(elf_object const *NONNULL objects, size_t count, u64 addr,
+                   str entry, bytes *NONNULL text, u64 *NONNULL entry_addr) {
+    linked_symbols globals = {0};
+    bool           ok      = link_text(objects, count, addr, text, &globals);
+    linked_symbol *start   = find_global(&globals, entry);
+    if (ok && start == NULL) {
+        fprintf(stderr, "(linker) entry symbol %s is not defined\n",
+                entry.data);
+        ok = false;
+    }
+    if (ok) {
+        *entry_addr = start->addr;
+    }
+    da_free(&globals);
+    return ok;
+}
+
+bool elf_link_executable(elf_object const *NONNULL objects, size_t count,
+                         str entry, bytes *NONNULL out) {
+    // The whole file is mapped as one read only, executable segment, the
+    // merged .text follows directly after the headers.
+    u64 const text_offset =
+        (EHDR_SIZE + PHDR_SIZE * 2 + 15) & ~(u64)15;
+
+    bytes          text    = {0};
+    linked_symbols globals = {0};
+    bool           ok      = link_text(objects, count, EXEC_BASE + text_offset,
+                                       &text, &globals);
+    linked_symbol *start   = find_global(&globals, entry);
+    if (ok && start == NULL) {
+        fprintf(stderr, "(linker) entry symbol %s is not defined\n",
+                entry.data);
+        ok = false;
+    }
+
+    if (!ok) {
+        da_free(&globals);
+        bytes_free(text);
+        return false;
+    }
+
+    size_t header_start = out->count;
+    for (size_t i = 0; i < EHDR_SIZE; i++) {
+        bytes_u8(out, 0);
+    }
+    u64 file_size = text_offset + text.count;
+    write_program_header(out, PT_LOAD, PF_R | PF_X, 0, EXEC_BASE, file_size,
+                         0x1000);
+    write_program_header(out, PT_GNU_STACK, PF_R | PF_W, 0, 0, 0, 16);
+    bytes_align(out, 16);
+    assert(out->count - header_start == text_offset);
+    bytes_append(out, text.items, text.count);
+
+    // The section headers are not needed to run the executable, but make it
+    // possible to inspect it with objdump and debuggers.
+    bytes shstrtab = {0}, strtab = {0}, symtab = {0};
+    u32   names[EXEC_SEC_COUNT];
+    bytes_u8(&shstrtab, 0);
+    names[EXEC_SEC_NULL]     = 0;
+    names[EXEC_SEC_TEXT]     = strtab_add(&shstrtab, S(".text"));
+    names[EXEC_SEC_SYMTAB]   = strtab_add(&shstrtab, S(".symtab"));
+    names[EXEC_SEC_STRTAB]   = strtab_add(&shstrtab, S(".strtab"));
+    names[EXEC_SEC_SHSTRTAB] = strtab_add(&shstrtab, S(".shstrtab"));
+
+    bytes_u8(&strtab, 0);
+    write_symbol(&symtab, 0, STB_LOCAL, STT_NOTYPE, 0, 0, 0);
+    for (size_t i = 0; i < globals.count; i++) {
+        write_symbol(&symtab, strtab_add(&strtab, globals.items[i].name),
+                     STB_GLOBAL, STT_FUNC, EXEC_SEC_TEXT, globals.items[i].addr,
+                     0);
+    }
+
+    section_header sections[EXEC_SEC_COUNT] = {0};
+    sections[EXEC_SEC_TEXT]                 = (section_header){
+                        .type      = SHT_PROGBITS,
+                        .flags     = SHF_ALLOC | SHF_EXECINSTR,
+                        .addr      = EXEC_BASE + text_offset,
+                        .offset    = text_offset,
+                        .size      = text.count,
+                        .addralign = 16,
+    };
+
+    bytes_align(out, 8);
+    sections[EXEC_SEC_SYMTAB] = (section_header){
+        .type      = SHT_SYMTAB,
+        .offset    = out->count - header_start,
+        .size      = symtab.count,
+        .link      = EXEC_SEC_STRTAB,
+        .info      = 1,
+        .addralign = 8,
+        .entsize   = SYM_SIZE,
+    };
+    bytes_append(out, symtab.items, symtab.count);
+
+    sections[EXEC_SEC_STRTAB] = (section_header){
+        .type      = SHT_STRTAB,
+        .offset    = out->count - header_start,
+        .size      = strtab.count,
+        .addralign = 1,
+    };
+    bytes_append(out, strtab.items, strtab.count);
+
+    sections[EXEC_SEC_SHSTRTAB] = (section_header){
+        .type      = SHT_STRTAB,
+        .offset    = out->count - header_start,
+        .size      = shstrtab.count,
+        .addralign = 1,
+    };
+    bytes_append(out, shstrtab.items, shstrtab.count);
+
+    bytes_align(out, 8);
+    u64 shoff = out->count - header_start;
+    for (size_t i = 0; i < EXEC_SEC_COUNT; i++) {
+        sections[i].name = names[i];
+        write_section_header(out, sections[i]);
+    }
+
+    write_elf_header(out, header_start, ET_EXEC, start->addr, EHDR_SIZE, 2,
+                     shoff, EXEC_SEC_COUNT, EXEC_SEC_SHSTRTAB);
+
+    da_free(&globals);
+    bytes_free(text);
+    bytes_free(symtab);
+    bytes_free(strtab);
+    bytes_free(shstrtab);
+    return true;
+}
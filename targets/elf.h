@@ -0,0 +1,69 @@
+#pragma once
+
+#include "rbcc.h"
+
+// A minimal in memory object file, that the machine code encoders fill and
+// the elf writer serializes. There is only one section, .text.
+
+typedef struct elf_symbol {
+    str  name; // owned
+    u64  value; // offset into .text
+    u64  size;
+    bool global;
+    bool defined;
+} elf_symbol;
+
+typedef enum elf_reloc_kind {
+    ELF_RELOC_PC32,  // S + A - P
+    ELF_RELOC_PLT32, // L + A - P, treated like PC32 for static code
+} elf_reloc_kind;
+
+typedef struct elf_reloc {
+    u64            offset; // offset of the 32 bit field in .text
+    u32            symbol; // index into elf_object.symbols
+    i64            addend;
+    elf_reloc_kind kind;
+} elf_reloc;
+
+typedef struct elf_symbols {
+    elf_symbol *NULLABLE items;
+    size_t               count;
+    size_t               capacity;
+} elf_symbols;
+
+typedef struct elf_relocs {
+    elf_reloc *NULLABLE items;
+    size_t              count;
+    size_t              capacity;
+} elf_relocs;
+
+typedef struct elf_object {
+    bytes       text;
+    elf_symbols symbols;
+    elf_relocs  relocs;
+} elf_object;
+
+// Returns the index of the symbol with that name, adds a undefined symbol if
+// it does not exist yet.
+u32  elf_object_symbol(elf_object *NONNULL obj, str name);
+// Defines the symbol at the current end of .text
+u32  elf_object_define(elf_object *NONNULL obj, str name, bool global);
+void elf_object_reloc(elf_object *NONNULL obj, elf_reloc_kind kind, u32 symbol,
+                      i64 addend);
+void elf_object_free(elf_object obj);
+
+// Serializes the object as a ELF64 relocatable (ET_REL) for x86_64
+void elf_write_relocatable(elf_object *NONNULL obj, bytes *NONNULL out);
+
+// Links the objects into a static ELF64 executable for x86_64, that starts
+// at the symbol entry. Prints the errors and returns false, if a symbol is
+// undefined or defined more than once.
+bool elf_link_executable(elf_object const *NONNULL objects, size_t count,
+                         str entry, bytes *NONNULL out);
+
+// The size of the .text elf_link_text merges the objects into
+size_t elf_linked_text_size(elf_object const *NONNULL objects, size_t count);
+// Links the objects like elf_link_executable, but only into the machine code,
+// that has to be loaded at addr. entry_addr is set to the address of entry.
+bool elf_link_text(elf_object const *NONNULL objects, size_t count, u64 addr,
+                   str entry, bytes *NONNULL text, u64 *NONNULL entry_addr);
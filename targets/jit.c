@@ -0,0 +1,75 @@
+#if defined(__linux__) || defined(__unix__)
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+#define _POSIX_C_SOURCE 200809L
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "rbcc.h"
+#include "targets/elf.h"
+#include "targets/targets.h"
+
+// The code can only be called, if it is for the machine the compiler runs on
+#if defined(__linux__) && defined(__x86_64__)
+#define JIT_HOST        1
+#define JIT_HOST_TARGET TARGET_X86_64_LINUX
+#else
+#define JIT_HOST 0
+#endif
+
+bool jit_run(target target, elf_object const *NONNULL objects, size_t count,
+             str entry, i64 *NONNULL result) {
+#if JIT_HOST
+    if (target != JIT_HOST_TARGET) {
+        fprintf(stderr, "(jit) can only run code for the host\n");
+        return false;
+    }
+
+    // The code is linked for the address of the mapping, then the mapping is
+    // made executable instead of writable
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size =
+        (elf_linked_text_size(objects, count) + page - 1) & ~(page - 1);
+    if (size == 0) {
+        size = page;
+    }
+    u8 *code = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        perror("(jit) mmap");
+        return false;
+    }
+
+    bytes text       = {0};
+    u64   entry_addr = 0;
+    bool  ok         = elf_link_text(objects, count, (u64)(uintptr_t)code,
+                                     entry, &text, &entry_addr);
+    if (ok) {
+        memcpy(code, text.items, text.count);
+        if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+            perror("(jit) mprotect");
+            ok = false;
+        }
+    }
+    bytes_free(text);
+
+    if (ok) {
+        // The generated functions follow the System V calling convention
+        i64 (*fn)(void) = (i64 (*)(void))(uintptr_t)entry_addr;
+        *result         = fn();
+    }
+    munmap(code, size);
+    return ok;
+#else
+    (void)target;
+    (void)objects;
+    (void)count;
+    (void)entry;
+    (void)result;
+    fprintf(stderr, "(jit) running code in memory is not supported on this "
+                    "host\n");
+    return false;
+#endif
+}
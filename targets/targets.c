@@ -1,13 +1,66 @@
 #include "targets.h"
+#include <stdlib.h>
+#include <string.h>
+#include "rbcc.h"
+#include "targets/elf.h"
 #include "targets/x86_64-linux.h"
 
-target get_default_target(void) { return TARGET_X86_64_LINUX; }
+target  get_default_target(void) { return TARGET_X86_64_LINUX; }
 
-void   code_gen(char const *NONNULL file_name, target target,
-                ir_program program) {
+backend get_default_backend(void) { return BACKEND_ELF; }
+
+linker  get_default_linker(void) { return LINKER_INTERNAL; }
+
+void    code_gen(char const *NONNULL file_name, target target, backend backend,
+                 ir_program program) {
     switch (target) {
         case TARGET_X86_64_LINUX:
-            x86_64_linux_emit_code(program, file_name);
+            switch (backend) {
+                case BACKEND_ELF:
+                    x86_64_linux_emit_object(program, file_name);
+                    break;
+                case BACKEND_FASM:
+                    x86_64_linux_emit_code(program, file_name);
+                    break;
+            }
             break;
     }
 }
+
+void code_gen_object(target target, ir_program program,
+                     elf_object *NONNULL obj) {
+    switch (target) {
+        case TARGET_X86_64_LINUX:
+            x86_64_linux_gen_object(program, obj);
+            break;
+    }
+}
+
+bool link_executable(char const *NONNULL file_name, target target,
+                     elf_object const *NONNULL objects, size_t count,
+                     str entry) {
+    // The start object comes first, so _start is at the beginning of .text
+    elf_object *all = xmalloc(sizeof(elf_object) * (count + 1));
+    all[0]          = (elf_object){0};
+    switch (target) {
+        case TARGET_X86_64_LINUX:
+            x86_64_linux_gen_start(entry, &all[0]);
+            break;
+    }
+    memcpy(all + 1, objects, sizeof(elf_object) * count);
+
+    bytes content = {0};
+    bool  ok      = elf_link_executable(all, count + 1, S("_start"), &content);
+    elf_object_free(all[0]);
+    free(all);
+
+    if (ok) {
+        ok = write_file(file_name, content) && make_executable(file_name);
+        if (!ok) {
+            fprintf(stderr, "(linker) could not write %s: %s\n", file_name,
+                    strerror(errno));
+        }
+    }
+    bytes_free(content);
+    return ok;
+}
@@ -2,11 +2,39 @@
 
 #include "ir.h"
 #include "rbcc.h"
+#include "targets/elf.h"
 
 typedef enum target {
     TARGET_X86_64_LINUX,
 } target;
 
-target get_default_target(void);
+typedef enum backend {
+    BACKEND_ELF,  // Encodes the machine code and writes the object file itself
+    BACKEND_FASM, // Writes assembly text, that has to be assembled with fasm
+} backend;
 
-void code_gen(char const *NONNULL file_name, target target, ir_program program);
+typedef enum linker {
+    LINKER_INTERNAL, // Links a static executable in process, without libc
+    LINKER_GCC,      // Links the object file with gcc against libc
+} linker;
+
+target  get_default_target(void);
+backend get_default_backend(void);
+linker  get_default_linker(void);
+
+// Writes a object file for BACKEND_ELF or a fasm file for BACKEND_FASM
+void code_gen(char const *NONNULL file_name, target target, backend backend,
+              ir_program program);
+
+// Generates the machine code into obj, this is what BACKEND_ELF writes.
+void code_gen_object(target target, ir_program program, elf_object *NONNULL obj);
+// Links the objects into a static executable with a target specific entry
+// point, that calls the function entry. Returns false if linking failed.
+bool link_executable(char const *NONNULL file_name, target target,
+                     elf_object const *NONNULL objects, size_t count,
+                     str entry);
+// Links the objects into a executable mapping and calls the function entry,
+// result is what it returned. Returns false if linking failed or the target
+// is not the machine the compiler runs on.
+bool jit_run(target target, elf_object const *NONNULL objects, size_t count,
+             str entry, i64 *NONNULL result);
@@ -0,0 +1,115 @@
+#pragma once
+
+// The x86_64 assembly representation, shared between the fasm text emitter
+// and the machine code encoder. It is allocated in the codegen arena.
+
+#include <stddef.h>
+#include "ir.h"
+#include "rbcc.h"
+#include "targets/elf.h"
+
+typedef struct asm_operand {
+    enum asm_operand_tag {
+        asm_op_pseudo,
+        asm_op_imm,
+        asm_op_stack,
+        asm_op_register,
+        asm_op_symbol,
+    } tag;
+
+    union {
+        struct asm_op_pseudo {
+            ir_vreg value;
+        } asm_op_pseudo;
+        struct asm_op_imm {
+            i64 value;
+        } asm_op_imm;
+        struct asm_op_stack {
+            i64 value; // offset from rbp
+        } asm_op_stack;
+        struct asm_op_register {
+            // In the order of their encoding
+            enum asm_register {
+                REG_AX,
+                REG_CX,
+                REG_DX,
+                REG_BX,
+                REG_SP,
+                REG_BP,
+                REG_SI,
+                REG_DI,
+                REG_R8,
+                REG_R9,
+                REG_R10,
+                REG_R11,
+                REG_R12,
+                REG_R13,
+                REG_R14,
+                REG_R15,
+                REG_MAX,
+            } value;
+        } asm_op_register;
+        struct asm_op_symbol {
+            str value; // the name of a function
+        } asm_op_symbol;
+    } data;
+} asm_operand;
+
+asm_operand *NONNULL asm_operand_new(arena *NONNULL a, asm_operand operand);
+
+#define OP_NEW(a, tag, ...) \
+    asm_operand_new((a), (asm_operand){tag, {.tag = (struct tag){__VA_ARGS__}}})
+
+// The number used for the register in the ModRM, SIB and REX bytes
+u8                asm_register_encoding(enum asm_register reg);
+char const *NONNULL asm_register_name(enum asm_register reg);
+
+typedef struct asm_instruction {
+    enum asm_instruction_tag {
+        ASM_INST_MOV,  // dst = src
+        ASM_INST_ADD,  // dst += src
+        ASM_INST_SUB,  // dst -= src
+        ASM_INST_IMUL, // dst *= src
+        ASM_INST_IDIV, // rax = rdx:rax / src, rdx = rdx:rax % src
+        ASM_INST_CQO,  // sign extends rax into rdx:rax
+        ASM_INST_PUSH, // pushes src
+        ASM_INST_POP,  // pops into dst
+        ASM_INST_RET,
+        ASM_INST_CALL, // calls src, which has to be a symbol
+        ASM_INST_SYSCALL,
+    } tag;
+    asm_operand *NULLABLE src, *NULLABLE dst;
+} asm_instruction;
+
+typedef struct asm_instructions {
+    asm_instruction *NULLABLE items;
+    size_t                    count;
+    size_t                    capacity;
+} asm_instructions;
+
+typedef struct asm_function {
+    str              name;
+    asm_instructions insts;
+} asm_function;
+
+typedef struct asm_program {
+    asm_function function;
+} asm_program;
+
+asm_program  cg_program(arena *NONNULL a, ir_program prog);
+// Replaces the pseudo operands of the function with registers, or stack slots
+// if it runs out of registers, and makes all instructions encodable. It also
+// adds the prologue and epilogue, if the function needs a stack frame.
+void x86_64_allocate_registers(arena *NONNULL a, asm_function *NONNULL func,
+                               u32 vreg_count);
+// The entry point of a executable linked without libc, it calls the function
+// entry and exits with its result.
+asm_function cg_start(arena *NONNULL a, str entry);
+
+// Encodes the program into machine code and appends it to the .text of the
+// object, every function gets a global symbol.
+void x86_64_encode_program(asm_program *NONNULL prog, elf_object *NONNULL obj);
+void x86_64_encode_function(asm_function *NONNULL func,
+                            elf_object *NONNULL   obj);
+
+void PRINTF_FORMAT(1, 2) fail(char const *NONNULL msg, ...);
@@ -0,0 +1,236 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include "rbcc.h"
+#include "targets/elf.h"
+#include "targets/x86_64-asm.h"
+
+// x86_64 machine code encoder
+// All operations are 64 bit, because of that every instruction that takes a
+// register or memory operand gets a REX.W prefix.
+
+#define REX_W 0x48
+#define REX_R 0x04
+#define REX_B 0x01
+
+static bool fits_i8(i64 value) { return value >= INT8_MIN && value <= INT8_MAX; }
+
+static bool fits_i32(i64 value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static bool is_rm(asm_operand *NONNULL op) {
+    return op->tag == asm_op_register || op->tag == asm_op_stack;
+}
+
+static u8 reg_of(asm_operand *NONNULL op) {
+    if (op->tag != asm_op_register) {
+        fail("expected a register operand, got %d", op->tag);
+    }
+    return asm_register_encoding(op->data.asm_op_register.value);
+}
+
+static void encode_opcode(bytes *NONNULL code, u16 opcode) {
+    if (opcode > 0xff) {
+        bytes_u8(code, (u8)(opcode >> 8));
+    }
+    bytes_u8(code, (u8)opcode);
+}
+
+// Emits REX.W, the opcode and the ModRM byte (with displacement) for a
+// instruction in the "op r/m64, reg" form. reg can also be a opcode extension
+// (the /digit in the intel manual). Two byte opcodes are written as 0x0fxx.
+static void encode_rm(bytes *NONNULL code, u16 opcode, u8 reg,
+                      asm_operand *NONNULL rm) {
+    switch (rm->tag) {
+        case asm_op_register: {
+            u8 rm_reg = reg_of(rm);
+            bytes_u8(code, REX_W | (reg & 8 ? REX_R : 0) |
+                               (rm_reg & 8 ? REX_B : 0));
+            encode_opcode(code, opcode);
+            bytes_u8(code, 0xc0 | (reg & 7) << 3 | (rm_reg & 7));
+            return;
+        }
+        case asm_op_stack: {
+            // [rbp + disp], rbp always needs a displacement
+            i64 disp = rm->data.asm_op_stack.value;
+            bytes_u8(code, REX_W | (reg & 8 ? REX_R : 0));
+            encode_opcode(code, opcode);
+            if (fits_i8(disp)) {
+                bytes_u8(code, 0x40 | (reg & 7) << 3 | 5);
+                bytes_u8(code, (u8)(i8)disp);
+            } else if (fits_i32(disp)) {
+                bytes_u8(code, 0x80 | (reg & 7) << 3 | 5);
+                bytes_u32(code, (u32)(i32)disp);
+            } else {
+                fail("stack offset %ld is out of range", disp);
+            }
+            return;
+        }
+        case asm_op_imm:
+        case asm_op_pseudo:
+        case asm_op_symbol:
+            fail("operand %d can not be encoded as r/m", rm->tag);
+    }
+}
+
+static void encode_mov(bytes *NONNULL code, asm_operand *NONNULL src,
+                       asm_operand *NONNULL dst) {
+    if (src->tag == asm_op_imm) {
+        i64 value = src->data.asm_op_imm.value;
+        if (fits_i32(value)) {
+            // mov r/m64, imm32 (sign extended)
+            encode_rm(code, 0xc7, 0, dst);
+            bytes_u32(code, (u32)(i32)value);
+        } else {
+            // mov r64, imm64
+            u8 reg = reg_of(dst);
+            bytes_u8(code, REX_W | (reg & 8 ? REX_B : 0));
+            bytes_u8(code, 0xb8 + (reg & 7));
+            bytes_u64(code, (u64)value);
+        }
+    } else if (src->tag == asm_op_register && is_rm(dst)) {
+        // mov r/m64, r64
+        encode_rm(code, 0x89, reg_of(src), dst);
+    } else if (dst->tag == asm_op_register && is_rm(src)) {
+        // mov r64, r/m64
+        encode_rm(code, 0x8b, reg_of(dst), src);
+    } else {
+        fail("invalid operands for mov");
+    }
+}
+
+// add and sub, ext is the opcode extension of the immediate forms
+static void encode_alu(bytes *NONNULL code, u8 ext, u8 op_rm_reg, u8 op_reg_rm,
+                       asm_operand *NONNULL src, asm_operand *NONNULL dst) {
+    if (src->tag == asm_op_imm) {
+        i64 value = src->data.asm_op_imm.value;
+        if (fits_i8(value)) {
+            // op r/m64, imm8 (sign extended)
+            encode_rm(code, 0x83, ext, dst);
+            bytes_u8(code, (u8)(i8)value);
+        } else if (fits_i32(value)) {
+            // op r/m64, imm32 (sign extended)
+            encode_rm(code, 0x81, ext, dst);
+            bytes_u32(code, (u32)(i32)value);
+        } else {
+            fail("immediate %ld does not fit in 32 bits", value);
+        }
+    } else if (src->tag == asm_op_register && is_rm(dst)) {
+        // op r/m64, r64
+        encode_rm(code, op_rm_reg, reg_of(src), dst);
+    } else if (dst->tag == asm_op_register && is_rm(src)) {
+        // op r64, r/m64
+        encode_rm(code, op_reg_rm, reg_of(dst), src);
+    } else {
+        fail("invalid operands for instruction %d", ext);
+    }
+}
+
+static void encode_imul(bytes *NONNULL code, asm_operand *NONNULL src,
+                        asm_operand *NONNULL dst) {
+    u8 reg = reg_of(dst);
+    if (src->tag == asm_op_imm) {
+        i64 value = src->data.asm_op_imm.value;
+        if (fits_i8(value)) {
+            // imul r64, r/m64, imm8
+            encode_rm(code, 0x6b, reg, dst);
+            bytes_u8(code, (u8)(i8)value);
+        } else if (fits_i32(value)) {
+            // imul r64, r/m64, imm32
+            encode_rm(code, 0x69, reg, dst);
+            bytes_u32(code, (u32)(i32)value);
+        } else {
+            fail("immediate %ld does not fit in 32 bits", value);
+        }
+    } else {
+        // imul r64, r/m64
+        encode_rm(code, 0x0faf, reg, src);
+    }
+}
+
+// push and pop, the operand size is always 64 bit, so no REX.W
+static void encode_stack_op(bytes *NONNULL code, u8 opcode,
+                            asm_operand *NULLABLE op) {
+    if (!op) {
+        fail("push/pop is missing a operand");
+    }
+    u8 reg = reg_of(op);
+    if (reg & 8) {
+        bytes_u8(code, 0x40 | REX_B);
+    }
+    bytes_u8(code, opcode + (reg & 7));
+}
+
+static void encode_instruction(elf_object *NONNULL obj, asm_instruction inst) {
+    switch (inst.tag) {
+        case ASM_INST_RET:
+            bytes_u8(&obj->text, 0xc3);
+            return;
+        case ASM_INST_MOV:
+            if (!inst.src || !inst.dst) {
+                fail("mov is missing a operand");
+            }
+            encode_mov(&obj->text, inst.src, inst.dst);
+            return;
+        case ASM_INST_CALL:
+            if (!inst.src || inst.src->tag != asm_op_symbol) {
+                fail("call expects a symbol");
+            }
+            // call rel32
+            bytes_u8(&obj->text, 0xe8);
+            elf_object_reloc(
+                obj, ELF_RELOC_PLT32,
+                elf_object_symbol(obj, inst.src->data.asm_op_symbol.value), -4);
+            return;
+        case ASM_INST_SYSCALL:
+            bytes_u8(&obj->text, 0x0f);
+            bytes_u8(&obj->text, 0x05);
+            return;
+        case ASM_INST_ADD:
+        case ASM_INST_SUB:
+        case ASM_INST_IMUL:
+            if (!inst.src || !inst.dst) {
+                fail("instruction %d is missing a operand", inst.tag);
+            }
+            if (inst.tag == ASM_INST_ADD) {
+                encode_alu(&obj->text, 0, 0x01, 0x03, inst.src, inst.dst);
+            } else if (inst.tag == ASM_INST_SUB) {
+                encode_alu(&obj->text, 5, 0x29, 0x2b, inst.src, inst.dst);
+            } else {
+                encode_imul(&obj->text, inst.src, inst.dst);
+            }
+            return;
+        case ASM_INST_IDIV:
+            if (!inst.src || !is_rm(inst.src)) {
+                fail("idiv expects a register or memory operand");
+            }
+            // idiv r/m64
+            encode_rm(&obj->text, 0xf7, 7, inst.src);
+            return;
+        case ASM_INST_CQO:
+            bytes_u8(&obj->text, REX_W);
+            bytes_u8(&obj->text, 0x99);
+            return;
+        case ASM_INST_PUSH:
+            encode_stack_op(&obj->text, 0x50, inst.src);
+            return;
+        case ASM_INST_POP:
+            encode_stack_op(&obj->text, 0x58, inst.dst);
+            return;
+    }
+}
+
+void x86_64_encode_function(asm_function *NONNULL func,
+                            elf_object *NONNULL   obj) {
+    bytes_align(&obj->text, 16);
+    u32 symbol = elf_object_define(obj, func->name, true);
+    for (size_t i = 0; i < func->insts.count; i++) {
+        encode_instruction(obj, func->insts.items[i]);
+    }
+    elf_symbol *sym = &obj->symbols.items[symbol];
+    sym->size       = obj->text.count - sym->value;
+}
+
+void x86_64_encode_program(asm_program *NONNULL prog, elf_object *NONNULL obj) {
+    x86_64_encode_function(&prog->function, obj);
+}
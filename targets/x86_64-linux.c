@@ -7,83 +7,70 @@
 #include "da.h"
 #include "ir.h"
 #include "rbcc.h"
+#include "targets/elf.h"
+#include "targets/x86_64-asm.h"
 
-typedef struct asm_operand {
-    enum asm_operand_tag {
-        asm_op_pseudo,
-        asm_op_imm,
-        asm_op_stack,
-        asm_op_register,
-    } tag;
-
-    union {
-        struct asm_op_pseudo {
-            str value;
-        } asm_op_pseudo;
-        struct asm_op_imm {
-            i64 value;
-        } asm_op_imm;
-        struct asm_op_stack {
-            i64 value;
-        } asm_op_stack;
-        struct asm_op_register {
-            enum asm_register {
-                REG_AX,
-                REG_R9,
-                REG_R10,
-            } value;
-        } asm_op_register;
-    } data;
-} asm_operand;
-
-asm_operand *asm_operand_new(asm_operand operand) {
-    asm_operand *ptr = malloc(sizeof(asm_operand));
+asm_operand *NONNULL asm_operand_new(arena *NONNULL a, asm_operand operand) {
+    asm_operand *ptr = arena_alloc(a, sizeof(asm_operand));
     *ptr             = operand;
     return ptr;
 }
 
-void asm_operand_free(asm_operand *ptr) { free(ptr); }
-
-#define OP_NEW(tag, ...) \
-    asm_operand_new((asm_operand){tag, {.tag = (struct tag){__VA_ARGS__}}})
-
-typedef struct asm_instruction {
-    enum asm_instruction_tag {
-        ASM_INST_MOV,
-        ASM_INST_ADD,
-        ASM_INST_SUB,
-        ASM_INST_IDIV,
-        ASM_INST_MUL,
-        ASM_INST_RET,
-    } tag;
-} asm_instruction;
+u8 asm_register_encoding(enum asm_register reg) {
+    if (reg >= REG_MAX) {
+        fail("unknown register %d", reg);
+    }
+    return (u8)reg;
+}
 
-typedef struct asm_instructions {
-    asm_instruction *items;
-    size_t           count;
-    size_t           capacity;
-} asm_instructions;
+char const *NONNULL asm_register_name(enum asm_register reg) {
+    static char const *const names[] = {
+        [REG_AX] = "rax", [REG_CX] = "rcx", [REG_DX] = "rdx",
+        [REG_BX] = "rbx", [REG_SP] = "rsp", [REG_BP] = "rbp",
+        [REG_SI] = "rsi", [REG_DI] = "rdi", [REG_R8] = "r8",
+        [REG_R9] = "r9",  [REG_R10] = "r10", [REG_R11] = "r11",
+        [REG_R12] = "r12", [REG_R13] = "r13", [REG_R14] = "r14",
+        [REG_R15] = "r15",
+    };
+    if (reg >= REG_MAX) {
+        fail("unknown register %d", reg);
+    }
+    return names[reg];
+}
 
-typedef struct asm_function {
-    str              name;
-    asm_instructions insts;
-} asm_function;
+static asm_operand *NONNULL cg_value(arena *NONNULL a, ir_value value) {
+    switch (value.tag) {
+        case value_constant:
+            return OP_NEW(a, asm_op_imm, value.data.value_constant.value);
+        case value_temp:
+            return OP_NEW(a, asm_op_pseudo, value.data.value_temp.value);
+        case value_none:
+            break;
+    }
+    fail("unknown ir value %d", value.tag);
+    return NULL;
+}
 
-typedef struct asm_program {
-    asm_function function;
-} asm_program;
+static void push_inst(arena *NONNULL a, asm_instructions *NONNULL insts,
+                      enum asm_instruction_tag tag, asm_operand *NULLABLE src,
+                      asm_operand *NULLABLE dst) {
+    asm_instruction inst = {.tag = tag, .src = src, .dst = dst};
+    arena_da_append(a, insts, inst);
+}
 
-static asm_instructions cg_instruction(ir_instruction inst) {
-    asm_instructions insts = {0};
+static void cg_instruction(arena *NONNULL a, asm_instructions *NONNULL insts,
+                           ir_instruction inst) {
+    enum asm_instruction_tag tag;
     switch (inst.kind) {
         case INST_RET: {
-            asm_instruction ret = {
-                .tag = ASM_INST_RET,
-            };
-            da_append(&insts, ret);
+            if (inst.lhs.tag == value_none) {
+                fail("invalid ir ret instruction, lhs is none");
+            }
+            push_inst(a, insts, ASM_INST_MOV, cg_value(a, inst.lhs),
+                      OP_NEW(a, asm_op_register, REG_AX));
+            push_inst(a, insts, ASM_INST_RET, NULL, NULL);
             break;
         }
-        enum asm_instruction_tag tag;
         case INST_ADD:
             tag = ASM_INST_ADD;
             goto binary;
@@ -91,34 +78,65 @@ static asm_instructions cg_instruction(ir_instruction inst) {
             tag = ASM_INST_SUB;
             goto binary;
         case INST_MUL:
-            tag = ASM_INST_MUL;
-            goto binary;
-        case INST_DIV:
-            tag = ASM_INST_IDIV;
+            tag = ASM_INST_IMUL;
             goto binary;
         binary:
+            // dst = lhs; dst op= rhs
+            push_inst(a, insts, ASM_INST_MOV, cg_value(a, inst.lhs),
+                      cg_value(a, inst.dst));
+            push_inst(a, insts, tag, cg_value(a, inst.rhs),
+                      cg_value(a, inst.dst));
+            break;
+        case INST_DIV:
+            push_inst(a, insts, ASM_INST_MOV, cg_value(a, inst.lhs),
+                      OP_NEW(a, asm_op_register, REG_AX));
+            push_inst(a, insts, ASM_INST_CQO, NULL, NULL);
+            push_inst(a, insts, ASM_INST_IDIV, cg_value(a, inst.rhs), NULL);
+            push_inst(a, insts, ASM_INST_MOV, OP_NEW(a, asm_op_register, REG_AX),
+                      cg_value(a, inst.dst));
+            break;
     }
-
-    return insts;
 }
 
-static asm_function cg_function(ir_function* func) {
+static asm_function cg_function(arena *NONNULL a, interner *NONNULL names,
+                                ir_function *NONNULL func) {
     asm_instructions insts = {0};
     for (size_t i = 0; i < func->instructions.len; i++) {
-        asm_instructions insts = cg_instruction(func->instructions.data[i]);
-        da_append_list(&insts, &insts);
+        cg_instruction(a, &insts, func->instructions.data[i]);
     }
 
-    return (asm_function){.insts = insts, .name = str_clone(func->name)};
+    asm_function result = {.insts = insts,
+                           .name  = interned_str(names, func->name)};
+    x86_64_allocate_registers(a, &result, func->vreg_count);
+    return result;
 }
 
-static asm_program cg_program(ir_program prog) {
-    return (asm_program){.function = cg_function(prog.main_function)};
+asm_program cg_program(arena *NONNULL a, ir_program prog) {
+    return (asm_program){
+        .function = cg_function(a, prog.names, prog.main_function)};
 }
 
+// Read this for argv and argc, when we need them:
+// http://dbp-consulting.com/tutorials/debugging/linuxProgramStartup.html
+asm_function cg_start(arena *NONNULL a, str entry) {
+    asm_instructions insts = {0};
+    // Mark the deepest stack frame
+    push_inst(a, &insts, ASM_INST_MOV, OP_NEW(a, asm_op_imm, 0),
+              OP_NEW(a, asm_op_register, REG_BP));
+    push_inst(a, &insts, ASM_INST_CALL,
+              OP_NEW(a, asm_op_symbol, arena_str_clone(a, entry)), NULL);
+    push_inst(a, &insts, ASM_INST_MOV, OP_NEW(a, asm_op_register, REG_AX),
+              OP_NEW(a, asm_op_register, REG_DI));
+    // exit(rdi)
+    push_inst(a, &insts, ASM_INST_MOV, OP_NEW(a, asm_op_imm, 60),
+              OP_NEW(a, asm_op_register, REG_AX));
+    push_inst(a, &insts, ASM_INST_SYSCALL, NULL, NULL);
+    return (asm_function){.insts = insts, .name = S("_start")};
+}
 
 typedef struct state {
-    FILE *NONNULL file;
+    // The whole assembly, it is written to the file at once
+    bytes out;
 } state;
 
 void PRINTF_FORMAT(1, 2) fail(char const *NONNULL msg, ...) {
@@ -133,85 +151,173 @@ void PRINTF_FORMAT(1, 2) fail(char const *NONNULL msg, ...) {
     va_end(arg);
 }
 
-void emitf(state *NONNULL s, char const *NONNULL msg, ...) {
-    va_list arg;
-    va_start(arg, msg);
-    vfprintf(s->file, msg, arg);
-    va_end(arg);
+static void emit(state *NONNULL s, char const *NONNULL text) {
+    bytes_append(&s->out, text, strlen(text));
+}
+
+// Formats the integer without printf, plus also prints the sign of positive
+// values
+static void emit_i64(state *NONNULL s, i64 value, bool plus) {
+    char   buffer[21];
+    size_t i         = sizeof(buffer);
+    // Negated as unsigned, so INT64_MIN does not overflow
+    u64    magnitude = value < 0 ? -(u64)value : (u64)value;
+    do {
+        buffer[--i] = (char)('0' + magnitude % 10);
+        magnitude  /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        buffer[--i] = '-';
+    } else if (plus) {
+        buffer[--i] = '+';
+    }
+    bytes_append(&s->out, buffer + i, sizeof(buffer) - i);
 }
 
-static void  emit_function(state *s, ir_function *func);
-static void  emit_program(state *s, ir_program prog);
-static void  emit_instruction(state *s, ir_instruction inst);
-static char *get_value(ir_value *value);
+static void emit_function(state *NONNULL s, asm_function *NONNULL func);
+static void emit_program(state *NONNULL s, asm_program *NONNULL prog);
+static void emit_instruction(state *NONNULL s, asm_instruction inst);
+static void emit_operand(state *NONNULL s, asm_operand *NULLABLE op);
 
-void         x86_64_linux_emit_code(ir_program program, char const *file_name) {
-    errno   = 0;
-    state s = {
-                .file = fopen(file_name, "w+"),
-    };
-    if (s.file == NULL) {
-        fail("Could not open file %s because: %s", file_name, strerror(errno));
+void        x86_64_linux_emit_code(ir_program program, char const *file_name) {
+    state       s       = {0};
+    arena       codegen = {0};
+    asm_program prog    = cg_program(&codegen, program);
+    emit(&s, "format ELF64\nsection '.text' executable\n");
+    emit_program(&s, &prog);
+    arena_free(&codegen);
+
+    if (!write_file(file_name, s.out)) {
+        fail("Could not write file %s because: %s", file_name, strerror(errno));
     }
-    emitf(&s, "format ELF64\nsection '.text' executable\n");
-    emit_program(&s, program);
-    fclose(s.file);
+    bytes_free(s.out);
 }
 
-static void emit_program(state *NONNULL s, ir_program prog) {
-    emit_function(s, prog.main_function);
+void x86_64_linux_gen_object(ir_program program, elf_object *NONNULL obj) {
+    arena       codegen = {0};
+    asm_program prog    = cg_program(&codegen, program);
+    x86_64_encode_program(&prog, obj);
+    arena_free(&codegen);
+}
 
-    // TODO: Clear up what we need to setup for libc and use our own main
-    // Read this for argv and argc:
-    // http://dbp-consulting.com/tutorials/debugging/linuxProgramStartup.html
-    /*emitf(s, */
-    /*      "public _start\n"*/
-    /*      "_start:\n"*/
-    /*      "  xor rbp,rbp\n"*/
-    /*      "  call %s\n"*/
-    /*      "  mov rdi, rax\n"*/
-    /*      "  mov rax, 60\n"*/
-    /*      "  syscall\n",*/
-    /*      prog.main_function->name.data);*/
+void x86_64_linux_gen_start(str entry, elf_object *NONNULL obj) {
+    arena        codegen = {0};
+    asm_function start   = cg_start(&codegen, entry);
+    x86_64_encode_function(&start, obj);
+    arena_free(&codegen);
 }
 
-static void emit_function(state *NONNULL s, ir_function *NONNULL func) {
-    emitf(s, "public %s\n", func->name.data);
-    emitf(s, "%s:\n", func->name.data);
+void x86_64_linux_emit_object(ir_program program, char const *file_name) {
+    elf_object obj = {0};
+    x86_64_linux_gen_object(program, &obj);
 
-    for (size_t i = 0; i < func->instructions.len; i++) {
-        emit_instruction(s, func->instructions.data[i]);
+    bytes content = {0};
+    elf_write_relocatable(&obj, &content);
+    elf_object_free(obj);
+
+    if (!write_file(file_name, content)) {
+        fail("Could not write file %s because: %s", file_name, strerror(errno));
     }
+    bytes_free(content);
 }
 
-static void emit_instruction(state *NONNULL s, ir_instruction inst) {
-    switch (inst.kind) {
-        case INST_RET: {
-            if (!inst.lhs) {
-                fail("invalid ir ret instruction, lhs is null");
-            }
-            char *lhs = get_value(inst.lhs);
-            emitf(s, "  mov rax,%s\n", lhs);
-            free(lhs);
-            emitf(s, "  ret\n");
+static void emit_program(state *NONNULL s, asm_program *NONNULL prog) {
+    // The fasm output is always linked against libc, which provides _start,
+    // see cg_start for the entry point of the internal linker.
+    emit_function(s, &prog->function);
+}
+
+static void emit_function(state *NONNULL s, asm_function *NONNULL func) {
+    emit(s, "public ");
+    bytes_append(&s->out, func->name.data, func->name.len);
+    emit(s, "\n");
+    bytes_append(&s->out, func->name.data, func->name.len);
+    emit(s, ":\n");
+
+    for (size_t i = 0; i < func->insts.count; i++) {
+        emit_instruction(s, func->insts.items[i]);
+    }
+}
+
+static void emit_instruction(state *NONNULL s, asm_instruction inst) {
+    char const *name = "";
+    switch (inst.tag) {
+        case ASM_INST_RET:
+            emit(s, "  ret\n");
+            return;
+        case ASM_INST_SYSCALL:
+            emit(s, "  syscall\n");
+            return;
+        case ASM_INST_CQO:
+            emit(s, "  cqo\n");
+            return;
+        case ASM_INST_CALL:
+            name = "call";
+            goto unary;
+        case ASM_INST_IDIV:
+            name = "idiv";
+            goto unary;
+        case ASM_INST_PUSH:
+            name = "push";
+            goto unary;
+        unary:
+            emit(s, "  ");
+            emit(s, name);
+            emit(s, " ");
+            emit_operand(s, inst.src);
+            emit(s, "\n");
+            return;
+        case ASM_INST_POP:
+            emit(s, "  pop ");
+            emit_operand(s, inst.dst);
+            emit(s, "\n");
+            return;
+        case ASM_INST_MOV:
+            name = "mov";
             break;
-        }
-        case INST_ADD:
-        case INST_SUB:
-        case INST_MUL:
-        case INST_DIV:
+        case ASM_INST_ADD:
+            name = "add";
+            break;
+        case ASM_INST_SUB:
+            name = "sub";
+            break;
+        case ASM_INST_IMUL:
+            name = "imul";
             break;
     }
+
+    emit(s, "  ");
+    emit(s, name);
+    emit(s, " ");
+    emit_operand(s, inst.dst);
+    emit(s, ",");
+    emit_operand(s, inst.src);
+    emit(s, "\n");
 }
 
-static char *get_value(ir_value *NONNULL ptr) {
-    ir_value value = *ptr;
-    switch (value.tag) {
-        case value_constant: {
-            struct value_constant data = value.data.value_constant;
-            return alloc_print("%ld", data.value);
-        }
-        case value_temp:
-            break;
+static void emit_operand(state *NONNULL s, asm_operand *NULLABLE ptr) {
+    if (!ptr) {
+        fail("missing operand");
+    }
+    asm_operand op = *ptr;
+    switch (op.tag) {
+        case asm_op_imm:
+            emit_i64(s, op.data.asm_op_imm.value, false);
+            return;
+        case asm_op_register:
+            emit(s, asm_register_name(op.data.asm_op_register.value));
+            return;
+        case asm_op_stack:
+            emit(s, "qword [rbp");
+            emit_i64(s, op.data.asm_op_stack.value, true);
+            emit(s, "]");
+            return;
+        case asm_op_symbol:
+            bytes_append(&s->out, op.data.asm_op_symbol.value.data,
+                         op.data.asm_op_symbol.value.len);
+            return;
+        case asm_op_pseudo:
+            fail("pseudo operand %%%u was not replaced",
+                 op.data.asm_op_pseudo.value);
     }
 }
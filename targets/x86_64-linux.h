@@ -1,5 +1,14 @@
 #pragma once
 
 #include "ir.h"
+#include "rbcc.h"
+#include "targets/elf.h"
 
+// Emits fasm assembly text
 void x86_64_linux_emit_code(ir_program program, char const *file_name);
+// Emits a ELF64 relocatable object file directly
+void x86_64_linux_emit_object(ir_program program, char const *file_name);
+// Appends the machine code of the program to obj
+void x86_64_linux_gen_object(ir_program program, elf_object *NONNULL obj);
+// Appends a _start that calls entry and exits with its return value
+void x86_64_linux_gen_start(str entry, elf_object *NONNULL obj);
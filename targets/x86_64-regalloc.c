@@ -0,0 +1,326 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "da.h"
+#include "rbcc.h"
+#include "targets/x86_64-asm.h"
+
+// Linear scan register allocation, as described by Poletto and Sarkar.
+// The functions do not have control flow yet, so the live interval of a
+// virtual register goes from its first to its last use in the instruction
+// list, and the first use is always the definition.
+
+// rax and rdx are used by idiv and ret, r10 and r11 are the scratch registers
+// of the fixups and rsp and rbp hold the stack frame. The caller saved
+// registers come first, so that small functions do not need to save anything.
+static enum asm_register const allocatable[] = {
+    REG_CX, REG_SI,  REG_DI,  REG_R8,  REG_R9,
+    REG_BX, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+#define ALLOCATABLE_COUNT (sizeof(allocatable) / sizeof(*allocatable))
+#define SCRATCH_SRC       REG_R10
+#define SCRATCH_DST       REG_R11
+
+typedef struct live_interval {
+    ir_vreg vreg;
+    u32     start, end; // indices into the instructions, inclusive
+} live_interval;
+
+typedef struct location {
+    bool              spilled;
+    enum asm_register reg;
+    u32               slot;
+} location;
+
+typedef struct allocator {
+    location *NONNULL locations; // indexed by the vreg
+    // Sorted by increasing end
+    live_interval *NONNULL active[ALLOCATABLE_COUNT];
+    size_t                 active_count;
+    bool                   reg_free[REG_MAX];
+    bool                   reg_used[REG_MAX];
+    u32                    spill_slots;
+} allocator;
+
+static bool is_callee_saved(enum asm_register reg) {
+    return reg == REG_BX || reg == REG_BP ||
+           (reg >= REG_R12 && reg <= REG_R15);
+}
+
+static int compare_intervals(void const *lhs_ptr, void const *rhs_ptr) {
+    live_interval const *lhs = lhs_ptr, *rhs = rhs_ptr;
+    if (lhs->start != rhs->start) {
+        return lhs->start < rhs->start ? -1 : 1;
+    }
+    return lhs->vreg < rhs->vreg ? -1 : lhs->vreg > rhs->vreg;
+}
+
+static void active_insert(allocator *NONNULL al,
+                          live_interval *NONNULL interval) {
+    size_t i = al->active_count;
+    while (i > 0 && al->active[i - 1]->end > interval->end) {
+        al->active[i] = al->active[i - 1];
+        i--;
+    }
+    al->active[i] = interval;
+    al->active_count++;
+}
+
+// Frees the registers of the intervals that ended before position
+static void expire_old_intervals(allocator *NONNULL al, u32 position) {
+    size_t expired = 0;
+    while (expired < al->active_count &&
+           al->active[expired]->end < position) {
+        location loc          = al->locations[al->active[expired]->vreg];
+        al->reg_free[loc.reg] = true;
+        expired++;
+    }
+    al->active_count -= expired;
+    memmove(al->active, al->active + expired,
+            al->active_count * sizeof(*al->active));
+}
+
+// Spills the interval that lives the longest, which is either interval or
+// the last active one.
+static void spill_at_interval(allocator *NONNULL al,
+                              live_interval *NONNULL interval) {
+    live_interval *last = al->active[al->active_count - 1];
+    if (last->end > interval->end) {
+        al->locations[interval->vreg] = al->locations[last->vreg];
+        al->locations[last->vreg] =
+            (location){.spilled = true, .slot = al->spill_slots++};
+        al->active_count--;
+        active_insert(al, interval);
+    } else {
+        al->locations[interval->vreg] =
+            (location){.spilled = true, .slot = al->spill_slots++};
+    }
+}
+
+static void allocate(allocator *NONNULL al, live_interval *NONNULL intervals,
+                     size_t count) {
+    for (size_t i = 0; i < ALLOCATABLE_COUNT; i++) {
+        al->reg_free[allocatable[i]] = true;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        live_interval *interval = &intervals[i];
+        expire_old_intervals(al, interval->start);
+        if (al->active_count == ALLOCATABLE_COUNT) {
+            spill_at_interval(al, interval);
+            continue;
+        }
+        for (size_t r = 0; r < ALLOCATABLE_COUNT; r++) {
+            enum asm_register reg = allocatable[r];
+            if (al->reg_free[reg]) {
+                al->reg_free[reg]             = false;
+                al->reg_used[reg]             = true;
+                al->locations[interval->vreg] = (location){.reg = reg};
+                break;
+            }
+        }
+        active_insert(al, interval);
+    }
+}
+
+static i64 slot_offset(u32 slot) { return -8 * ((i64)slot + 1); }
+
+static void rewrite_operand(allocator *NONNULL al, asm_operand *NULLABLE op) {
+    if (!op || op->tag != asm_op_pseudo) {
+        return;
+    }
+    location loc = al->locations[op->data.asm_op_pseudo.value];
+    if (loc.spilled) {
+        *op = (asm_operand){asm_op_stack,
+                            {.asm_op_stack = {slot_offset(loc.slot)}}};
+    } else {
+        *op = (asm_operand){asm_op_register, {.asm_op_register = {loc.reg}}};
+    }
+}
+
+static bool is_stack(asm_operand *NULLABLE op) {
+    return op && op->tag == asm_op_stack;
+}
+
+static bool is_wide_imm(asm_operand *NULLABLE op) {
+    return op && op->tag == asm_op_imm &&
+           (op->data.asm_op_imm.value < INT32_MIN ||
+            op->data.asm_op_imm.value > INT32_MAX);
+}
+
+static bool is_same_register(asm_operand *NULLABLE lhs,
+                             asm_operand *NULLABLE rhs) {
+    return lhs && rhs && lhs->tag == asm_op_register &&
+           rhs->tag == asm_op_register &&
+           lhs->data.asm_op_register.value == rhs->data.asm_op_register.value;
+}
+
+static void push_inst(arena *NONNULL a, asm_instructions *NONNULL insts,
+                      enum asm_instruction_tag tag, asm_operand *NULLABLE src,
+                      asm_operand *NULLABLE dst) {
+    asm_instruction inst = {.tag = tag, .src = src, .dst = dst};
+    arena_da_append(a, insts, inst);
+}
+
+typedef struct frame {
+    bool              needed;
+    i64               size;
+    enum asm_register saved[REG_MAX];
+    i64               saved_offsets[REG_MAX];
+    size_t            saved_count;
+} frame;
+
+static void push_prologue(arena *NONNULL a, asm_instructions *NONNULL out,
+                          frame *NONNULL f) {
+    push_inst(a, out, ASM_INST_PUSH, OP_NEW(a, asm_op_register, REG_BP), NULL);
+    push_inst(a, out, ASM_INST_MOV, OP_NEW(a, asm_op_register, REG_SP),
+              OP_NEW(a, asm_op_register, REG_BP));
+    push_inst(a, out, ASM_INST_SUB, OP_NEW(a, asm_op_imm, f->size),
+              OP_NEW(a, asm_op_register, REG_SP));
+    for (size_t i = 0; i < f->saved_count; i++) {
+        push_inst(a, out, ASM_INST_MOV,
+                  OP_NEW(a, asm_op_register, f->saved[i]),
+                  OP_NEW(a, asm_op_stack, f->saved_offsets[i]));
+    }
+}
+
+static void push_epilogue(arena *NONNULL a, asm_instructions *NONNULL out,
+                          frame *NONNULL f) {
+    for (size_t i = 0; i < f->saved_count; i++) {
+        push_inst(a, out, ASM_INST_MOV,
+                  OP_NEW(a, asm_op_stack, f->saved_offsets[i]),
+                  OP_NEW(a, asm_op_register, f->saved[i]));
+    }
+    push_inst(a, out, ASM_INST_MOV, OP_NEW(a, asm_op_register, REG_BP),
+              OP_NEW(a, asm_op_register, REG_SP));
+    push_inst(a, out, ASM_INST_POP, NULL, OP_NEW(a, asm_op_register, REG_BP));
+}
+
+// Makes the instruction encodable, x86_64 has no memory to memory
+// instructions, immediates are at most 32 bits (except for mov to a
+// register), imul needs a register destination and idiv a r/m operand.
+static void lower_instruction(arena *NONNULL a, asm_instructions *NONNULL out,
+                              frame *NONNULL f, asm_instruction inst) {
+    switch (inst.tag) {
+        case ASM_INST_MOV:
+            if (is_same_register(inst.src, inst.dst)) {
+                return;
+            }
+            if (is_stack(inst.dst) &&
+                (is_stack(inst.src) || is_wide_imm(inst.src))) {
+                asm_operand *scratch = OP_NEW(a, asm_op_register, SCRATCH_SRC);
+                push_inst(a, out, ASM_INST_MOV, inst.src, scratch);
+                inst.src = scratch;
+            }
+            break;
+        case ASM_INST_ADD:
+        case ASM_INST_SUB:
+            if (is_wide_imm(inst.src) ||
+                (is_stack(inst.src) && is_stack(inst.dst))) {
+                asm_operand *scratch = OP_NEW(a, asm_op_register, SCRATCH_SRC);
+                push_inst(a, out, ASM_INST_MOV, inst.src, scratch);
+                inst.src = scratch;
+            }
+            break;
+        case ASM_INST_IMUL:
+            if (is_wide_imm(inst.src)) {
+                asm_operand *scratch = OP_NEW(a, asm_op_register, SCRATCH_SRC);
+                push_inst(a, out, ASM_INST_MOV, inst.src, scratch);
+                inst.src = scratch;
+            }
+            if (is_stack(inst.dst)) {
+                asm_operand *scratch = OP_NEW(a, asm_op_register, SCRATCH_DST);
+                push_inst(a, out, ASM_INST_MOV, inst.dst, scratch);
+                push_inst(a, out, ASM_INST_IMUL, inst.src, scratch);
+                push_inst(a, out, ASM_INST_MOV, scratch, inst.dst);
+                return;
+            }
+            break;
+        case ASM_INST_IDIV:
+            if (inst.src && inst.src->tag == asm_op_imm) {
+                asm_operand *scratch = OP_NEW(a, asm_op_register, SCRATCH_SRC);
+                push_inst(a, out, ASM_INST_MOV, inst.src, scratch);
+                inst.src = scratch;
+            }
+            break;
+        case ASM_INST_RET:
+            if (f->needed) {
+                push_epilogue(a, out, f);
+            }
+            break;
+        case ASM_INST_CQO:
+        case ASM_INST_PUSH:
+        case ASM_INST_POP:
+        case ASM_INST_CALL:
+        case ASM_INST_SYSCALL:
+            break;
+    }
+    arena_da_append(a, out, inst);
+}
+
+void x86_64_allocate_registers(arena *NONNULL a, asm_function *NONNULL func,
+                               u32 vreg_count) {
+    live_interval *intervals =
+        arena_alloc(a, sizeof(live_interval) * (vreg_count + 1));
+    for (u32 i = 0; i < vreg_count; i++) {
+        intervals[i] = (live_interval){.vreg = i, .start = UINT32_MAX};
+    }
+    for (size_t i = 0; i < func->insts.count; i++) {
+        asm_operand *ops[] = {func->insts.items[i].src,
+                              func->insts.items[i].dst};
+        for (size_t j = 0; j < 2; j++) {
+            if (!ops[j] || ops[j]->tag != asm_op_pseudo) {
+                continue;
+            }
+            ir_vreg vreg = ops[j]->data.asm_op_pseudo.value;
+            if (vreg >= vreg_count) {
+                fail("virtual register %u is out of range", vreg);
+            }
+            if (intervals[vreg].start == UINT32_MAX) {
+                intervals[vreg].start = (u32)i;
+            }
+            intervals[vreg].end = (u32)i;
+        }
+    }
+
+    // Unused virtual registers sort to the end
+    qsort(intervals, vreg_count, sizeof(live_interval), compare_intervals);
+    size_t live = 0;
+    while (live < vreg_count && intervals[live].start != UINT32_MAX) {
+        live++;
+    }
+
+    allocator al = {
+        .locations = arena_alloc(a, sizeof(location) * (vreg_count + 1)),
+    };
+    allocate(&al, intervals, live);
+
+    for (size_t i = 0; i < func->insts.count; i++) {
+        rewrite_operand(&al, func->insts.items[i].src);
+        rewrite_operand(&al, func->insts.items[i].dst);
+    }
+
+    // The callee saved registers are stored below the spill slots
+    frame f = {0};
+    for (size_t i = 0; i < ALLOCATABLE_COUNT; i++) {
+        if (al.reg_used[allocatable[i]] && is_callee_saved(allocatable[i])) {
+            f.saved[f.saved_count] = allocatable[i];
+            f.saved_offsets[f.saved_count] =
+                slot_offset(al.spill_slots + (u32)f.saved_count);
+            f.saved_count++;
+        }
+    }
+    f.needed = al.spill_slots > 0 || f.saved_count > 0;
+    // Keeps rsp 16 byte aligned
+    f.size = ((i64)(al.spill_slots + f.saved_count) * 8 + 15) & ~(i64)15;
+
+    asm_instructions out = {0};
+    if (f.needed) {
+        push_prologue(a, &out, &f);
+    }
+    for (size_t i = 0; i < func->insts.count; i++) {
+        lower_instruction(a, &out, &f, func->insts.items[i]);
+    }
+    func->insts = out;
+}
@@ -1,5 +1,6 @@
 import subprocess
 import pathlib
+import re
 import tempfile
 
 import sys
@@ -79,31 +80,35 @@ class Test:
     def run_test(self) -> bool:
         logger = getLogger(self.test_name)
 
-        ast_find_str = "--- ast ---\n"
-        ast_start = self.input.find(ast_find_str)
-        ir_find_str = "--- ir ---\n"
-        ir_start = self.input.find(ir_find_str)
-        run_find_str = "--- run ---\n"
-        run_start = self.input.find(run_find_str)
-
-        if ast_start == -1:
+        # The headers of the sections, the ast and ir headers can be followed
+        # by extra compiler arguments, e.g. "--- ir -O0 ---"
+        headers = list(re.finditer(
+            r"^--- (ast|ir|run|diagnostics)(.*?) ---\n", self.input, re.M))
+        sections = {}
+        section_args = {}
+        for i, header in enumerate(headers):
+            end = headers[i + 1].start() if i + 1 < len(headers) \
+                else len(self.input)
+            sections[header.group(1)] = self.input[header.end():end]
+            section_args[header.group(1)] = header.group(2).split()
+
+        if "ast" not in sections:
             logger.error(
                 "Test %s(%s) does not contain a valid ast section",
                 self.test_name,
                 self.file)
             return False
 
-        if ir_start == -1:
+        if "ir" not in sections:
             logger.error(
                 "Test %s(%s) does not contain a valid ir section",
                 self.test_name,
                 self.file)
             return False
 
-        code = self.input[:ast_start]
-        ast = self.input[len(ast_find_str)+ast_start:ir_start]
-        ir = self.input[len(
-            ir_find_str)+ir_start:run_start if run_start != -1 else len(self.input)]
+        code = self.input[:headers[0].start()]
+        ast = sections["ast"]
+        ir = sections["ir"]
 
         code = code.strip()
         ast = ast.strip()
@@ -117,17 +122,24 @@ class Test:
                 code_file.write(code)
                 logger.debug("Written code section to %s", temp_code_file)
 
+            # The diagnostics start with the path of the file, which is in
+            # the temporary directory
+            def output(result: subprocess.CompletedProcess) -> str:
+                stdout = str(result.stdout.decode('utf8'))
+                return stdout.replace(str(temp_code_file),
+                                      self.file.name).strip()
+
             logger.info("Running ast test section")
             print_ast_result = subprocess.run(
                 ["./build/rbc", str(temp_code_file),
-                 "--print=ast", "--no-emit"],
+                 "--print=ast", "--no-emit"] + section_args["ast"],
                 capture_output=True)
             if print_ast_result.returncode != 0:
                 logger.error(
                     "./build/rbc failed with %d, stdout: %s, stderr: %s",
-                    print_ast_result.stdout, print_ast_result.stderr)
+                    print_ast_result.returncode, print_ast_result.stdout, print_ast_result.stderr)
                 return False
-            stdout = str(print_ast_result.stdout.decode('utf8')).strip()
+            stdout = output(print_ast_result)
             if stdout != ast:
                 logger.error("Expected \"%s\" to be \"%s\"", stdout, ast)
                 return False
@@ -135,26 +147,28 @@ class Test:
             logger.info("Running ir test section")
             print_ir_result = subprocess.run(
                 ["./build/rbc", str(temp_code_file),
-                 "--print=ir", "--no-emit"],
+                 "--print=ir", "--no-emit"] + section_args["ir"],
                 capture_output=True)
             if print_ir_result.returncode != 0:
                 logger.error(
                     "./build/rbc failed with %d, stdout: %s, stderr: %s",
-                    print_ir_result.stdout, print_ir_result.stderr)
+                    print_ir_result.returncode, print_ir_result.stdout, print_ir_result.stderr)
                 return False
-            stdout = str(print_ir_result.stdout.decode('utf8')).strip()
+            stdout = output(print_ir_result)
             if stdout != ir:
                 logger.error("Expected:\n%s\n to be:\n%s", stdout, ir)
                 return False
 
-            if run_start != -1:
-                run = self.input[len(run_find_str)+run_start:]
-                loaded_json = json.loads(run)
+            if "run" in sections:
+                loaded_json = json.loads(sections["run"])
                 return_code = loaded_json["return_code"]
+                # Extra compiler arguments, e.g. to disable optimizations
+                args = loaded_json.get("args", [])
                 temp_exe = temp_code_file.with_suffix("")
                 logger.info("Running run test section")
                 compile = subprocess.run(
-                    ["./build/rbc", str(temp_code_file), "-o", str(temp_exe)],
+                    ["./build/rbc", str(temp_code_file), "-o", str(temp_exe)]
+                    + args,
                     capture_output=True)
                 if compile.returncode != 0:
                     stdout = str(compile.stdout.decode('utf8'))
@@ -173,10 +187,266 @@ class Test:
                         return_code, test.returncode)
                     return False
 
+                logger.info("Running run test section in memory")
+                jit = subprocess.run(
+                    ["./build/rbc", str(temp_code_file), "--run"] + args,
+                    capture_output=True)
+                if jit.returncode != return_code:
+                    logger.error(
+                        "--run test failed, expected return code %s, got %s",
+                        return_code, jit.returncode)
+                    return False
+
+                logger.info("Running run test section in the interpreter")
+                interpret = subprocess.run(
+                    ["./build/rbc", str(temp_code_file), "--interpret"] + args,
+                    capture_output=True)
+                if interpret.returncode != return_code:
+                    logger.error(
+                        "--interpret test failed, expected return code %s, got %s",
+                        return_code, interpret.returncode)
+                    return False
+
+            if "diagnostics" in sections:
+                # A list of compilations, that print nothing but the
+                # diagnostics, and their expected output and exit code
+                for case in json.loads(sections["diagnostics"]):
+                    args = case.get("args", [])
+                    logger.info("Running diagnostics test section %s", args)
+                    result = subprocess.run(
+                        ["./build/rbc", str(temp_code_file),
+                         "--print=none", "--no-emit"] + args,
+                        capture_output=True)
+                    stdout = output(result)
+                    if result.returncode != case["exit_code"]:
+                        logger.error(
+                            "diagnostics test %s failed, expected exit code "
+                            "%s, got %s", args, case["exit_code"],
+                            result.returncode)
+                        return False
+                    if stdout != case["stdout"].strip():
+                        logger.error("Expected:\n%s\n to be:\n%s", stdout,
+                                     case["stdout"])
+                        return False
+
         logger.info("Success")
         return True
 
 
+# The print passes hold the lock of stdout, so the output of a unit is
+# printed in one piece: its ast line or its function
+def output_chunks(output: str) -> list[str]:
+    chunks = []
+    for line in output.splitlines():
+        if line.startswith("program(") or line.startswith("function "):
+            chunks.append(line)
+        elif chunks:
+            chunks[-1] += "\n" + line
+    return sorted(chunks)
+
+
+def test_parallel() -> bool:
+    """Compiles several files with -j and compares the result with -j 1"""
+    logger = getLogger("parallel")
+    with tempfile.TemporaryDirectory() as temp_dir:
+        temp_path = pathlib.Path(temp_dir)
+        files = []
+        for i in range(1, 8):
+            file = temp_path / f"f{i}.rbc"
+            file.write_text(f"fn f{i}() = {i} * 3 + {i};\n")
+            files.append(str(file))
+        main = temp_path / "main.rbc"
+        main.write_text("fn main() = 100 * 3 - 1;\n")
+        files.append(str(main))
+
+        results = {}
+        for jobs in ["1", "4"]:
+            exe = temp_path / f"out{jobs}"
+            result = subprocess.run(
+                ["./build/rbc", "-j", jobs, "-o", str(exe)] + files,
+                capture_output=True)
+            if result.returncode != 0:
+                logger.error("-j %s failed with %d, stdout: %s, stderr: %s",
+                             jobs, result.returncode, result.stdout,
+                             result.stderr)
+                return False
+            results[jobs] = (output_chunks(result.stdout.decode('utf8')),
+                             exe.read_bytes())
+            run = subprocess.run([str(exe)])
+            if run.returncode != 299 & 0xff:
+                logger.error("-j %s executable returned %d, expected %d",
+                             jobs, run.returncode, 299 & 0xff)
+                return False
+        if results["1"][0] != results["4"][0]:
+            logger.error("-j 4 printed:\n%s\nbut -j 1 printed:\n%s",
+                         results["4"][0], results["1"][0])
+            return False
+        if results["1"][1] != results["4"][1]:
+            logger.error("-j 4 linked a different executable than -j 1")
+            return False
+
+        # A unit that fails stops the link, but not the other units
+        bad = temp_path / "bad.rbc"
+        bad.write_text("fn bad() = 1 +;\n")
+        result = subprocess.run(
+            ["./build/rbc", "-j", "4", "--print=none", "-o",
+             str(temp_path / "bad")] + files + [str(bad)],
+            capture_output=True)
+        stdout = result.stdout.decode('utf8')
+        if result.returncode == 0 or "bad.rbc[1:" not in stdout:
+            logger.error("-j 4 with a bad unit exited with %d, stdout: %s",
+                         result.returncode, stdout)
+            return False
+    logger.info("Success")
+    return True
+
+
+def test_program(name: str, program: str) -> bool:
+    """Runs one of the test programs, that build.lua links from tests/*/*.c"""
+    logger = getLogger(name)
+    try:
+        # A hang, like a lexer that does not advance, fails the test
+        result = subprocess.run([program], capture_output=True, timeout=60)
+    except subprocess.TimeoutExpired:
+        logger.error("%s did not finish in 60 seconds", program)
+        return False
+    if result.returncode != 0:
+        logger.error("%s failed with %d\n%s", program, result.returncode,
+                     result.stderr.decode('utf8'))
+        return False
+    logger.info("Success")
+    return True
+
+
+def test_server() -> bool:
+    """Compiles through --server and --client, the client runs in another
+    directory, so the relative paths have to be resolved in its directory"""
+    logger = getLogger("server")
+    rbc = str(pathlib.Path("./build/rbc").resolve())
+    with tempfile.TemporaryDirectory() as temp_dir:
+        temp_path = pathlib.Path(temp_dir)
+        socket_path = temp_path / "rbc.sock"
+        (temp_path / "main.rbc").write_text("fn main() = 6 * 7;\n")
+        (temp_path / "bad.rbc").write_text("fn main() = 4 / 0;\n")
+        not_socket = temp_path / "main.c"
+        not_socket.write_text("keep")
+
+        refused = subprocess.run([rbc, f"--server={not_socket}"],
+                                 capture_output=True)
+        if refused.returncode == 0 or not_socket.read_text() != "keep":
+            logger.error("--server replaced a file, that is not a socket")
+            return False
+
+        server = subprocess.Popen([rbc, f"--server={socket_path}"],
+                                  stderr=subprocess.PIPE)
+        try:
+            # The server prints a line, when it is listening
+            server.stderr.readline()
+            second = subprocess.run([rbc, f"--server={socket_path}"],
+                                    capture_output=True)
+            if second.returncode == 0:
+                logger.error("a second server took over the socket")
+                return False
+
+            for args in [["--print=ir", "main.rbc", "-o", "main"],
+                         ["--print=none", "--interpret", "main.rbc"],
+                         ["--print=none", "bad.rbc", "-o", "bad"]]:
+                local = subprocess.run([rbc] + args, capture_output=True,
+                                       cwd=temp_dir)
+                remote = subprocess.run(
+                    [rbc, f"--client={socket_path}"] + args,
+                    capture_output=True, cwd=temp_dir)
+                if (remote.returncode, remote.stdout, remote.stderr) != \
+                        (local.returncode, local.stdout, local.stderr):
+                    logger.error("--client %s returned %d, stdout: %s, "
+                                 "stderr: %s, but rbc returned %d, stdout: "
+                                 "%s, stderr: %s", args, remote.returncode,
+                                 remote.stdout, remote.stderr,
+                                 local.returncode, local.stdout,
+                                 local.stderr)
+                    return False
+
+            subprocess.run([rbc, f"--client={socket_path}", "--print=none",
+                            "main.rbc", "-o", "from_server"], cwd=temp_dir)
+            run = subprocess.run([str(temp_path / "from_server")])
+            if run.returncode != 42:
+                logger.error("the executable of the server returned %d",
+                             run.returncode)
+                return False
+        finally:
+            server.terminate()
+            server.wait()
+    logger.info("Success")
+    return True
+
+
+def test_cache() -> bool:
+    """Compiles with --cache-dir, --time-report prints if the cache was hit"""
+    logger = getLogger("cache")
+    rbc = str(pathlib.Path("./build/rbc").resolve())
+    with tempfile.TemporaryDirectory() as temp_dir:
+        temp_path = pathlib.Path(temp_dir)
+        cache_dir = temp_path / "cache"
+        (temp_path / "a.rbc").write_text("fn main() = 6 * 7;\n")
+        (temp_path / "b.rbc").write_text("fn main() = 2 + 3;\n")
+
+        def compile(source: str, output: str, *args: str) -> str:
+            result = subprocess.run(
+                [rbc, "--print=none", "--time-report",
+                 f"--cache-dir={cache_dir}", *args, source, "-o", output],
+                cwd=temp_dir, capture_output=True)
+            if result.returncode != 0:
+                return "failed"
+            for line in result.stderr.decode('utf8').splitlines():
+                if line.startswith("cache: "):
+                    return line[len("cache: "):]
+            return "not cached"
+
+        def entries() -> int:
+            return len(list(cache_dir.iterdir()))
+
+        if compile("a.rbc", "first") != "miss" or entries() != 1:
+            logger.error("the first compilation did not store a entry")
+            return False
+        if compile("a.rbc", "second") != "hit" or entries() != 1:
+            logger.error("the second compilation did not hit the entry")
+            return False
+        if (temp_path / "first").read_bytes() != \
+                (temp_path / "second").read_bytes():
+            logger.error("the cached executable differs from the compiled one")
+            return False
+        if subprocess.run([str(temp_path / "second")]).returncode != 42:
+            logger.error("the cached executable does not return 42")
+            return False
+
+        ignored = subprocess.run(
+            [rbc, "--print=ir", f"--cache-dir={cache_dir}", "a.rbc", "-o",
+             "third"], cwd=temp_dir, capture_output=True)
+        if b"--cache-dir is ignored" not in ignored.stderr:
+            logger.error("--cache-dir with --print=ir was silently ignored")
+            return False
+
+        # The key does not cover gcc, so its executables are not cached
+        external = subprocess.run(
+            [rbc, "--print=none", f"--cache-dir={cache_dir}", "--linker=gcc",
+             "a.rbc", "-o", "external"], cwd=temp_dir, capture_output=True)
+        if b"--cache-dir is ignored" not in external.stderr or \
+                entries() != 1:
+            logger.error("a executable linked by gcc was cached")
+            return False
+
+        # The entries are 656 bytes, so only the newest one fits
+        if compile("b.rbc", "b", "--cache-size=1K") != "miss" or \
+                entries() != 1:
+            logger.error("the least recently used entry was not evicted")
+            return False
+        if compile("a.rbc", "fourth") != "miss":
+            logger.error("the evicted entry was hit")
+            return False
+    logger.info("Success")
+    return True
+
+
 failed = False
 
 for file in tests_dir.iterdir():
@@ -185,6 +455,18 @@ for file in tests_dir.iterdir():
         if not test.run_test():
             failed = True
 
+if not test_parallel():
+    failed = True
+# The library api, see tests/api
+if not test_program("api", "./build/rbc-api-test"):
+    failed = True
+# The spill path of the register allocator, see tests/regalloc
+if not test_program("regalloc", "./build/rbc-regalloc-test"):
+    failed = True
+if not test_server():
+    failed = True
+if not test_cache():
+    failed = True
+
 if failed:
-    import os
-    os.exit(1)
+    sys.exit(1)
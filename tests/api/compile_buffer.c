@@ -0,0 +1,110 @@
+// Tests rbc_compile_buffer with a diagnostic sink, run by tests.py
+#include <stdio.h>
+#include <string.h>
+#include "rbc.h"
+#include "rbcc.h"
+
+#define MAX_DIAGNOSTICS 8
+
+typedef struct sink {
+    rbc_diagnostic diagnostics[MAX_DIAGNOSTICS];
+    char           messages[MAX_DIAGNOSTICS][128];
+    size_t         count;
+} sink;
+
+// The diagnostic is only valid during the call, so the message is copied
+static void collect(void *NULLABLE data,
+                    rbc_diagnostic const *NONNULL diagnostic) {
+    sink *s = data;
+    if (s->count == MAX_DIAGNOSTICS) {
+        return;
+    }
+    snprintf(s->messages[s->count], sizeof(s->messages[0]), "%s",
+             diagnostic->message);
+    s->diagnostics[s->count]         = *diagnostic;
+    s->diagnostics[s->count].message = s->messages[s->count];
+    s->count++;
+}
+
+static u32 failures = 0;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #cond);                                                  \
+            failures++;                                                      \
+        }                                                                    \
+    } while (0)
+
+// Compiles the source with a fresh sink, the object is appended to object
+static bool compile(rbc_context *NONNULL ctx, sink *NONNULL s, str source,
+                    bytes *NONNULL object) {
+    *s = (sink){0};
+    return rbc_compile_buffer(ctx, S("test.rbc"), source, object);
+}
+
+int main(void) {
+    sink         s   = {0};
+    rbc_context *ctx = rbc_context_new((rbc_options){
+        .optimize        = true,
+        .diagnostic      = collect,
+        .diagnostic_data = &s,
+    });
+
+    // A valid program is a ELF relocatable object and reports nothing
+    bytes first = {0};
+    CHECK(compile(ctx, &s, S("fn main() = 1 + 2 * 3;\n"), &first));
+    CHECK(s.count == 0);
+    CHECK(ctx->errors == 0 && ctx->warnings == 0);
+    CHECK(first.count > 4 && memcmp(first.items, "\x7f" "ELF", 4) == 0);
+
+    // The context can be reused and gives the same object
+    bytes second = {0};
+    CHECK(compile(ctx, &s, S("fn main() = 1 + 2 * 3;\n"), &second));
+    CHECK(second.count == first.count &&
+          memcmp(second.items, first.items, first.count) == 0);
+    bytes_free(first);
+    bytes_free(second);
+
+    // Errors go to the sink instead of stdout and fail the compilation
+    bytes object = {0};
+    CHECK(!compile(ctx, &s, S("fn main() = 4 / 0;\n"), &object));
+    CHECK(s.count == 1);
+    CHECK(ctx->errors == 1);
+    CHECK(s.diagnostics[0].severity == RBC_ERROR);
+    CHECK(strcmp(s.diagnostics[0].phase, "Optimizer") == 0);
+    CHECK(strcmp(s.diagnostics[0].message, "division by zero") == 0);
+    CHECK(str_eq(s.diagnostics[0].loc.file, S("test.rbc")));
+    CHECK(s.diagnostics[0].loc.line == 1 && s.diagnostics[0].loc.column == 15);
+    CHECK(object.count == 0);
+
+    CHECK(!compile(ctx, &s, S("fn main() = 1 +;\n"), &object));
+    CHECK(s.count >= 1 && s.diagnostics[0].severity == RBC_ERROR);
+    CHECK(s.count >= 1 && strcmp(s.diagnostics[0].phase, "Parser") == 0);
+
+    // A zero byte inside a string is read like any other character, the
+    // lexer used to stop on it forever
+    CHECK(!compile(ctx, &s, S("fn main() = \"a\0b\";\n"), &object));
+    CHECK(s.count >= 1 && strcmp(s.diagnostics[0].phase, "Parser") == 0);
+    CHECK(s.count >= 1 && s.diagnostics[0].loc.column == 13);
+    CHECK(!compile(ctx, &s,
+                   S("fn main() = \"aaaaaaaaaaaaaaaaaaaaaaaa\0\0\0\0\";\n"),
+                   &object));
+    CHECK(s.count >= 1 && strcmp(s.diagnostics[0].phase, "Parser") == 0);
+
+    // Warnings do not fail the compilation
+    CHECK(compile(ctx, &s, S("fn main() = 9223372036854775807 + 1;\n"),
+                  &object));
+    CHECK(s.count == 1 && s.diagnostics[0].severity == RBC_WARNING);
+    CHECK(ctx->errors == 0 && ctx->warnings == 1);
+    CHECK(object.count > 0);
+    bytes_free(object);
+
+    rbc_context_free(ctx);
+    if (failures > 0) {
+        fprintf(stderr, "%u checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
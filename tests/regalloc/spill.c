@@ -0,0 +1,150 @@
+// Tests the spill path of the register allocator, run by tests.py. The
+// language can not keep enough values live to run out of registers, so the
+// function is built by hand.
+#include <stdio.h>
+#include "da.h"
+#include "rbcc.h"
+#include "targets/elf.h"
+#include "targets/targets.h"
+#include "targets/x86_64-asm.h"
+
+// One more than the allocatable registers, rcx, rsi, rdi, r8, r9, rbx and
+// r12 to r15, so two values do not get one
+#define VREG_COUNT 12
+
+static u32 failures = 0;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #cond);                                                  \
+            failures++;                                                      \
+        }                                                                    \
+    } while (0)
+
+static void push(arena *NONNULL a, asm_function *NONNULL func,
+                 enum asm_instruction_tag tag, asm_operand *NULLABLE src,
+                 asm_operand *NULLABLE dst) {
+    asm_instruction inst = {.tag = tag, .src = src, .dst = dst};
+    arena_da_append(a, &func->insts, inst);
+}
+
+static bool is_register(asm_operand const *NULLABLE op,
+                        enum asm_register reg) {
+    return op && op->tag == asm_op_register &&
+           op->data.asm_op_register.value == reg;
+}
+
+static bool is_stack(asm_operand const *NULLABLE op, i64 offset) {
+    return op && op->tag == asm_op_stack &&
+           op->data.asm_op_stack.value == offset;
+}
+
+int main(void) {
+    arena        a    = {0};
+    asm_function func = {.name = S("main")};
+
+    // Every vreg is defined first and used at the end, in the order of
+    // definition, so all of them are live at the same time:
+    //   v0 = 0, ..., v11 = 11, v0 += v1, ..., v0 += v11, rax = v0, ret
+    // The operands are rewritten in place, so they show the allocation.
+    asm_operand *defs[VREG_COUNT];
+    asm_operand *uses[VREG_COUNT];
+    for (u32 v = 0; v < VREG_COUNT; v++) {
+        defs[v] = OP_NEW(&a, asm_op_pseudo, v);
+        push(&a, &func, ASM_INST_MOV, OP_NEW(&a, asm_op_imm, v), defs[v]);
+    }
+    for (u32 v = 1; v < VREG_COUNT; v++) {
+        uses[v] = OP_NEW(&a, asm_op_pseudo, v);
+        push(&a, &func, ASM_INST_ADD, uses[v], OP_NEW(&a, asm_op_pseudo, 0));
+    }
+    uses[0] = OP_NEW(&a, asm_op_pseudo, 0);
+    push(&a, &func, ASM_INST_MOV, uses[0], OP_NEW(&a, asm_op_register, REG_AX));
+    push(&a, &func, ASM_INST_RET, NULL, NULL);
+
+    x86_64_allocate_registers(&a, &func, VREG_COUNT);
+
+    // v0 lives the longest, so it gives its register to v10. v11 ends after
+    // every other active value, so it is spilled itself.
+    CHECK(is_stack(defs[0], -8) && is_stack(uses[0], -8));
+    CHECK(is_stack(defs[11], -16) && is_stack(uses[11], -16));
+    CHECK(is_register(defs[10], REG_CX) && is_register(uses[10], REG_CX));
+    for (u32 v = 1; v < 10; v++) {
+        CHECK(defs[v]->tag == asm_op_register);
+        CHECK(uses[v]->tag == asm_op_register &&
+              uses[v]->data.asm_op_register.value ==
+                  defs[v]->data.asm_op_register.value);
+        for (u32 w = 1; w < v; w++) {
+            CHECK(defs[v]->data.asm_op_register.value !=
+                  defs[w]->data.asm_op_register.value);
+        }
+    }
+
+    // The two spill slots and rbx and r12 to r15, which are callee saved,
+    // rounded up to keep rsp 16 byte aligned
+    enum asm_register const saved[] = {REG_BX, REG_R12, REG_R13, REG_R14,
+                                       REG_R15};
+    size_t const saved_count = sizeof(saved) / sizeof(*saved);
+    asm_instructions insts   = func.insts;
+    if (insts.count < 3 + 2 * saved_count + 3) {
+        fprintf(stderr, "the function has only %zu instructions\n",
+                insts.count);
+        return 1;
+    }
+    CHECK(insts.items[0].tag == ASM_INST_PUSH &&
+          is_register(insts.items[0].src, REG_BP));
+    CHECK(insts.items[1].tag == ASM_INST_MOV &&
+          is_register(insts.items[1].src, REG_SP) &&
+          is_register(insts.items[1].dst, REG_BP));
+    CHECK(insts.items[2].tag == ASM_INST_SUB &&
+          insts.items[2].src->tag == asm_op_imm &&
+          insts.items[2].src->data.asm_op_imm.value == 64 &&
+          is_register(insts.items[2].dst, REG_SP));
+    for (size_t i = 0; i < saved_count; i++) {
+        asm_instruction save = insts.items[3 + i];
+        CHECK(save.tag == ASM_INST_MOV && is_register(save.src, saved[i]) &&
+              is_stack(save.dst, -24 - 8 * (i64)i));
+    }
+
+    // The registers are restored and the frame is released before the ret
+    size_t epilogue = insts.count - 1 - saved_count - 2;
+    for (size_t i = 0; i < saved_count; i++) {
+        asm_instruction restore = insts.items[epilogue + i];
+        CHECK(restore.tag == ASM_INST_MOV &&
+              is_stack(restore.src, -24 - 8 * (i64)i) &&
+              is_register(restore.dst, saved[i]));
+    }
+    asm_instruction release = insts.items[insts.count - 3];
+    CHECK(release.tag == ASM_INST_MOV && is_register(release.src, REG_BP) &&
+          is_register(release.dst, REG_SP));
+    CHECK(insts.items[insts.count - 2].tag == ASM_INST_POP &&
+          is_register(insts.items[insts.count - 2].dst, REG_BP));
+    CHECK(insts.items[insts.count - 1].tag == ASM_INST_RET);
+
+    // Nothing is left for the allocator and everything is encodable, the add
+    // of the two spilled values goes through a scratch register
+    for (size_t i = 0; i < insts.count; i++) {
+        asm_instruction inst = insts.items[i];
+        CHECK(!inst.src || inst.src->tag != asm_op_pseudo);
+        CHECK(!inst.dst || inst.dst->tag != asm_op_pseudo);
+        CHECK(!(inst.src && inst.dst && inst.src->tag == asm_op_stack &&
+                inst.dst->tag == asm_op_stack));
+    }
+
+    // It still computes 0 + 1 + ... + 11, if it can run on this machine
+    elf_object object = {0};
+    x86_64_encode_function(&func, &object);
+    i64 result = 0;
+    if (jit_run(TARGET_X86_64_LINUX, &object, 1, S("main"), &result)) {
+        CHECK(result == 66);
+    }
+    elf_object_free(object);
+
+    arena_free(&a);
+    if (failures > 0) {
+        fprintf(stderr, "%u checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}